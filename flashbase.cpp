@@ -110,6 +110,79 @@ QRectF FlashGeoRect::toRectM() const
   return {top_left.toMeters(), bottom_right.toMeters()};
 }
 
+bool FlashGeoRect::intersects(const FlashGeoRect& v) const
+{
+  return top_left.lon <= v.bottom_right.lon &&
+         v.top_left.lon <= bottom_right.lon &&
+         top_left.lat <= v.bottom_right.lat &&
+         v.top_left.lat <= bottom_right.lat;
+}
+
+void FlashGeoRect::save(QByteArray& ba, int coor_precision_coef) const
+{
+  using namespace FlashSerialize;
+  write(ba, top_left);
+  coor_precision_coef = std::max(1, coor_precision_coef);
+  qint64 span_lat =
+      std::ceil(1.0 * (qint64(bottom_right.lat) - top_left.lat) /
+                coor_precision_coef);
+  qint64 span_lon =
+      std::ceil(1.0 * (qint64(bottom_right.lon) - top_left.lon) /
+                coor_precision_coef);
+  span_lat = std::max(0ll, span_lat);
+  span_lon = std::max(0ll, span_lon);
+
+  if (span_lat <= 0xffff && span_lon <= 0xffff)
+  {
+    write(ba, (uchar)1);
+    write(ba, (ushort)span_lat);
+    write(ba, (ushort)span_lon);
+  }
+  else
+  {
+    write(ba, (uchar)2);
+    write(ba, (uint)span_lat);
+    write(ba, (uint)span_lon);
+  }
+}
+
+void FlashGeoRect::load(FlashSerialize::Cursor& c,
+                        int                     coor_precision_coef)
+{
+  using namespace FlashSerialize;
+  read(c, top_left);
+  coor_precision_coef = std::max(1, coor_precision_coef);
+
+  uchar span_type;
+  read(c, span_type);
+  qint64 span_lat = 0;
+  qint64 span_lon = 0;
+  if (span_type == 1)
+  {
+    ushort _span_lat = 0;
+    ushort _span_lon = 0;
+    read(c, _span_lat);
+    read(c, _span_lon);
+    span_lat = _span_lat;
+    span_lon = _span_lon;
+  }
+  else
+  {
+    uint _span_lat = 0;
+    uint _span_lon = 0;
+    read(c, _span_lat);
+    read(c, _span_lon);
+    span_lat = _span_lat;
+    span_lon = _span_lon;
+  }
+  bottom_right.lat = std::min<qint64>(
+      top_left.lat + span_lat * coor_precision_coef,
+      std::numeric_limits<int>::max());
+  bottom_right.lon = std::min<qint64>(
+      top_left.lon + span_lon * coor_precision_coef,
+      std::numeric_limits<int>::max());
+}
+
 FlashGeoRect FlashGeoPolygon::getFrame() const
 {
   using namespace std;
@@ -136,7 +209,7 @@ void FlashGeoPolygon::save(QByteArray& ba,
                            int         coor_precision_coef) const
 {
   using namespace FlashSerialize;
-  write(ba, count());
+  write(ba, int(count()));
 
   if (count() == 1)
   {
@@ -179,8 +252,7 @@ void FlashGeoPolygon::save(QByteArray& ba,
 
   if (span_type == 2)
   {
-    for (auto& point: (*this))
-      write(ba, point);
+    writeArray(ba, constData(), count());
     return;
   }
 
@@ -211,31 +283,34 @@ QPolygonF FlashGeoPolygon::toPolygonM()
   return ret;
 }
 
-void FlashGeoPolygon::load(const QByteArray& ba, int& pos,
-                           int coor_precision_coef)
+void FlashGeoPolygon::load(FlashSerialize::Cursor& c,
+                           int                     coor_precision_coef)
 {
   using namespace FlashSerialize;
-  int point_count;
-  read(ba, pos, point_count);
+  int point_count = 0;
+  read(c, point_count);
+  if (!c.check(point_count, 2))
+  {
+    clear();
+    return;
+  }
   resize(point_count);
 
   if (count() <= 2)
   {
-    for (auto& p: *this)
-      read(ba, pos, p);
+    readArray(c, data(), count());
     return;
   }
 
   FlashGeoCoor top_left;
-  read(ba, pos, top_left);
+  read(c, top_left);
 
   uchar span_type;
-  read(ba, pos, span_type);
+  read(c, span_type);
 
   if (span_type == 2)
   {
-    for (auto& point: (*this))
-      read(ba, pos, point);
+    readArray(c, data(), count());
     return;
   }
 
@@ -248,8 +323,8 @@ void FlashGeoPolygon::load(const QByteArray& ba, int& pos,
     {
       uchar _dlat = 0;
       uchar _dlon = 0;
-      read(ba, pos, _dlat);
-      read(ba, pos, _dlon);
+      read(c, _dlat);
+      read(c, _dlon);
       dlat = _dlat;
       dlon = _dlon;
     }
@@ -257,8 +332,8 @@ void FlashGeoPolygon::load(const QByteArray& ba, int& pos,
     {
       ushort _dlat = 0;
       ushort _dlon = 0;
-      read(ba, pos, _dlat);
-      read(ba, pos, _dlon);
+      read(c, _dlat);
+      read(c, _dlon);
       dlat = _dlat;
       dlon = _dlon;
     }
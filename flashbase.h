@@ -7,6 +7,11 @@
 #include <QPainter>
 #include <math.h>
 
+namespace FlashSerialize
+{
+struct Cursor;
+}
+
 namespace flashmath
 {
 constexpr double earth_r = 6378137;
@@ -45,13 +50,16 @@ struct FlashGeoRect
   QRectF       toMeters() const;
   QSizeF       getSizeMeters() const;
   QRectF       toRectM() const;
+  bool         intersects(const FlashGeoRect&) const;
+  void         save(QByteArray& ba, int coor_precision_coef) const;
+  void load(FlashSerialize::Cursor&, int coor_precision_coef);
 };
 
 struct FlashGeoPolygon: public QVector<FlashGeoCoor>
 {
   FlashGeoRect getFrame() const;
   void         save(QByteArray& ba, int coor_precision_coef) const;
-  void load(const QByteArray& ba, int& pos, int coor_precision_coef);
+  void load(FlashSerialize::Cursor&, int coor_precision_coef);
   QPolygonF toPolygonM();
 };
 
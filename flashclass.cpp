@@ -6,6 +6,189 @@
 #include <QJsonArray>
 #include <QJsonObject>
 #include <QMetaEnum>
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QMutex>
+#include <QCache>
+#include <QSet>
+
+class FlashImageCache
+{
+  static constexpr int data_cache_kb  = 16 * 1024;
+  static constexpr int image_cache_kb = 64 * 1024;
+
+  QMutex                         mutex;
+  QCache<QByteArray, QByteArray> data_by_hash;
+  QCache<QByteArray, QImage>     image_by_hash;
+
+  static int getCost(qint64 size);
+
+public:
+  FlashImageCache();
+  static FlashImageCache* instance();
+  QByteArray intern(const QByteArray& data, QByteArray& hash);
+  QImage     getImage(const QByteArray& hash, const QByteArray& data);
+  qint64     getMemoryUsage();
+};
+
+FlashImageCache::FlashImageCache()
+{
+  data_by_hash.setMaxCost(data_cache_kb);
+  image_by_hash.setMaxCost(image_cache_kb);
+}
+
+FlashImageCache* FlashImageCache::instance()
+{
+  static FlashImageCache cache;
+  return &cache;
+}
+
+int FlashImageCache::getCost(qint64 size)
+{
+  return int(std::max<qint64>(1, size / 1024));
+}
+
+QByteArray FlashImageCache::intern(const QByteArray& data,
+                                   QByteArray&       hash)
+{
+  hash = QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+  QMutexLocker locker(&mutex);
+  if (auto cached = data_by_hash.object(hash))
+    return *cached;
+  data_by_hash.insert(hash, new QByteArray(data), getCost(data.size()));
+  return data;
+}
+
+QImage FlashImageCache::getImage(const QByteArray& hash,
+                                 const QByteArray& data)
+{
+  {
+    QMutexLocker locker(&mutex);
+    if (auto cached = image_by_hash.object(hash))
+      return *cached;
+  }
+  auto         image = QImage::fromData(data);
+  QMutexLocker locker(&mutex);
+  image_by_hash.insert(hash, new QImage(image),
+                       getCost(image.sizeInBytes()));
+  return image;
+}
+
+qint64 FlashImageCache::getMemoryUsage()
+{
+  QMutexLocker locker(&mutex);
+  return (qint64(data_by_hash.totalCost()) + image_by_hash.totalCost()) *
+         1024;
+}
+
+bool FlashClass::isVisible(double mip) const
+{
+  return (min_mip == 0 || mip >= min_mip) &&
+         (max_mip == 0 || mip <= max_mip);
+}
+
+qint64 FlashClass::getImageCacheUsage()
+{
+  return FlashImageCache::instance()->getMemoryUsage();
+}
+
+QImage FlashClass::getImage() const
+{
+  if (image_data.isEmpty())
+    return QImage();
+  return FlashImageCache::instance()->getImage(image_hash, image_data);
+}
+
+void FlashClass::setImageData(const QByteArray& data)
+{
+  if (data.isEmpty())
+  {
+    image_data.clear();
+    image_hash.clear();
+    return;
+  }
+  image_data = FlashImageCache::instance()->intern(data, image_hash);
+}
+
+void FlashClass::setImage(const QImage& image)
+{
+  if (image.isNull())
+  {
+    setImageData(QByteArray());
+    return;
+  }
+  QByteArray data;
+  QBuffer    buffer(&data);
+  buffer.open(QIODevice::WriteOnly);
+  image.save(&buffer, "PNG");
+  setImageData(data);
+}
+
+FlashClassImageAtlas
+FlashClassImageAtlas::build(const QVector<FlashClass>& classes,
+                            int                        max_width)
+{
+  FlashClassImageAtlas     atlas;
+  QVector<int>             class_idx_list;
+  QVector<QImage>          images(classes.count());
+  QHash<QByteArray, QRect> rect_by_hash;
+  for (int i = -1; auto& cl: classes)
+  {
+    i++;
+    images[i] = cl.getImage();
+    if (!images.at(i).isNull())
+      class_idx_list.append(i);
+  }
+  std::stable_sort(class_idx_list.begin(), class_idx_list.end(),
+                   [&images](int a, int b)
+                   {
+                     return images.at(a).height() >
+                            images.at(b).height();
+                   });
+
+  int x       = 0;
+  int y       = 0;
+  int row_h   = 0;
+  int atlas_w = 0;
+  for (auto idx: class_idx_list)
+  {
+    auto& cl = classes.at(idx);
+    if (rect_by_hash.contains(cl.image_hash))
+      continue;
+    auto size = images.at(idx).size();
+    if (x > 0 && x + size.width() > max_width)
+    {
+      x = 0;
+      y += row_h;
+      row_h = 0;
+    }
+    rect_by_hash.insert(cl.image_hash, QRect(QPoint(x, y), size));
+    x += size.width();
+    row_h   = std::max(row_h, size.height());
+    atlas_w = std::max(atlas_w, x);
+  }
+
+  if (rect_by_hash.isEmpty())
+    return atlas;
+
+  atlas.image =
+      QImage(atlas_w, y + row_h, QImage::Format_ARGB32_Premultiplied);
+  atlas.image.fill(Qt::transparent);
+  QPainter p(&atlas.image);
+  p.setCompositionMode(QPainter::CompositionMode_Source);
+  QSet<QByteArray> drawn;
+  for (auto idx: class_idx_list)
+  {
+    auto& cl   = classes.at(idx);
+    auto  rect = rect_by_hash.value(cl.image_hash);
+    atlas.rects.insert(cl.id, rect);
+    if (drawn.contains(cl.image_hash))
+      continue;
+    drawn.insert(cl.image_hash);
+    p.drawImage(rect.topLeft(), images.at(idx));
+  }
+  return atlas;
+}
 
 void FlashClass::save(QFile* f) const
 {
@@ -30,7 +213,10 @@ void FlashClass::save(QFile* f) const
   write(f, (uchar)text.green());
   write(f, (uchar)text.blue());
   write(f, (uchar)text.alpha());
-  write(f, image);
+  int image_size = image_data.count();
+  write(f, image_size);
+  if (image_size > 0)
+    f->write(image_data);
   write(f, attributes);
 }
 
@@ -61,7 +247,9 @@ void FlashClass::load(QFile* f)
   read(f, blue);
   read(f, alpha);
   text = QColor(red, green, blue, alpha);
-  QImage img;
-  read(f, image);
+  int image_size = 0;
+  read(f, image_size);
+  if (image_size > 0)
+    setImageData(f->read(image_size));
   read(f, attributes);
 }
@@ -2,6 +2,7 @@
 
 #include "flashbase.h"
 #include <QMap>
+#include <QHash>
 
 struct FlashClass
 {
@@ -40,13 +41,20 @@ public:
   QColor                 pen;
   QColor                 brush;
   QColor                 text;
-  QImage                 image;
+  QByteArray             image_data;
+  QByteArray             image_hash;
   QMap<QString, QString> attributes;
 
   QMap<QString, QString> detect_tags;
 
-  void save(QFile* f) const;
-  void load(QFile* f);
+  void   save(QFile* f) const;
+  void   load(QFile* f);
+  bool   isVisible(double mip) const;
+  QImage getImage() const;
+  void   setImage(const QImage&);
+  void   setImageData(const QByteArray&);
+
+  static qint64 getImageCacheUsage();
 };
 
 struct FlashClassImage
@@ -56,3 +64,12 @@ struct FlashClassImage
 };
 
 typedef QVector<FlashClassImage> FlashClassImageList;
+
+struct FlashClassImageAtlas
+{
+  QImage                image;
+  QHash<QString, QRect> rects;
+
+  static FlashClassImageAtlas build(const QVector<FlashClass>&,
+                                    int max_width = 1024);
+};
@@ -180,9 +180,11 @@ FlashClassManager::processJsonObject(const QJsonObject& obj,
     auto image_name = obj.value("image").toString();
     if (!image_name.isEmpty())
     {
-      auto image_path = root_dir + "/images/" + image_name;
-      cl.image        = QImage(image_path);
-      if (cl.image.isNull())
+      auto  image_path = root_dir + "/images/" + image_name;
+      QFile image_file(image_path);
+      if (image_file.open(QIODevice::ReadOnly))
+        cl.setImageData(image_file.readAll());
+      if (cl.getImage().isNull())
         qDebug() << "error opening" << image_path;
     }
   }
@@ -297,11 +299,16 @@ const QStringList& FlashClassManager::getSaveAttributes() const
 FlashClassImageList FlashClassManager::getClassImageList() const
 {
   QVector<FlashClassImage> ret;
-  for (auto cl: classes)
-    ret.append({cl.id, cl.image});
+  for (auto& cl: classes)
+    ret.append({cl.id, cl.getImage()});
   return ret;
 }
 
+FlashClassImageAtlas FlashClassManager::getClassImageAtlas() const
+{
+  return FlashClassImageAtlas::build(classes);
+}
+
 void FlashClassManager::setMainMip(double v)
 {
   main_mip = v;
@@ -25,6 +25,7 @@ public:
   void                       loadClasses(QString path);
   void                       addClass(FlashClass);
   FlashClassImageList        getClassImageList() const;
+  FlashClassImageAtlas       getClassImageAtlas() const;
   const QVector<FlashClass>& getClasses() const;
   const QStringList&         getSaveAttributes() const;
 
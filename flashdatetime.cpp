@@ -1,17 +1,13 @@
 #include "flashdatetime.h"
 
 #include <QStringList>
+#include <QRandomGenerator>
+#include <QElapsedTimer>
+#include <QDebug>
 #include <math.h>
 
 FlashDateTime::FlashDateTime()
 {
-  year  = 0;
-  month = 0;
-  day   = 0;
-  hour  = 0;
-  min   = 0;
-  sec   = 0;
-  tz    = 0;
 }
 
 static QDateTime toQDateTime(FlashDateTime dt)
@@ -30,74 +26,177 @@ static FlashDateTime fromQDateTime(QDateTime dt, double time_zone)
                        time_zone);
 }
 
+static constexpr qint64 secs_per_day = 86400;
+
+qint64 FlashDateTime::daysFromCivil(int y, int m, int d)
+{
+  y -= m <= 2;
+  qint64   era = (y >= 0 ? y : y - 399) / 400;
+  unsigned yoe = unsigned(y - era * 400);
+  unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+  unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + qint64(doe) - 719468;
+}
+
+void FlashDateTime::civilFromDays(qint64 days, int& y, int& m, int& d)
+{
+  days += 719468;
+  qint64   era = (days >= 0 ? days : days - 146096) / 146097;
+  unsigned doe = unsigned(days - era * 146097);
+  unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  unsigned mp  = (5 * doy + 2) / 153;
+  d            = doy - (153 * mp + 2) / 5 + 1;
+  m            = mp < 10 ? mp + 3 : mp - 9;
+  y            = int(yoe + era * 400) + (m <= 2);
+}
+
+qint64 FlashDateTime::pack(qint64 utc_secs, int tz)
+{
+  return utc_secs * 256 + (tz + 128);
+}
+
+int FlashDateTime::getTz() const
+{
+  return int(packed & 0xff) - 128;
+}
+
+qint64 FlashDateTime::getUtcSecs() const
+{
+  return (packed - (packed & 0xff)) / 256;
+}
+
+qint64 FlashDateTime::getLocalSecs() const
+{
+  return getUtcSecs() + getTz() * (3600 / time_zone_coef);
+}
+
+FlashDateTime FlashDateTime::fromLocalSecs(qint64 secs, int tz)
+{
+  FlashDateTime dt;
+  dt.packed = pack(secs - tz * (3600 / time_zone_coef), tz);
+  return dt;
+}
+
+qint64 FlashDateTime::getPacked() const
+{
+  return packed;
+}
+
+FlashDateTime FlashDateTime::fromPacked(qint64 v)
+{
+  FlashDateTime dt;
+  dt.packed = v;
+  return dt;
+}
+
+void FlashDateTime::getFields(int& y, int& m, int& d, int& h, int& mi,
+                              int& s) const
+{
+  if (!isValid())
+  {
+    y = m = d = h = mi = s = 0;
+    return;
+  }
+  auto   secs = getLocalSecs();
+  qint64 days = secs / secs_per_day;
+  qint64 rem  = secs % secs_per_day;
+  if (rem < 0)
+  {
+    rem += secs_per_day;
+    days--;
+  }
+  civilFromDays(days, y, m, d);
+  h  = rem / 3600;
+  mi = rem % 3600 / 60;
+  s  = rem % 60;
+}
+
 FlashDateTime::FlashDateTime(int _year, int _month, int _day,
                              int _hour, int _min, int _sec,
                              double _tz)
 {
-  year  = _year;
-  month = _month;
-  day   = _day;
-  hour  = _hour;
-  min   = _min;
-  sec   = _sec;
-  setTimeZone(_tz);
+  if (_year == 0)
+    return;
+  qint64 local = daysFromCivil(_year, _month, _day) * secs_per_day +
+                 _hour * 3600 + _min * 60 + _sec;
+  *this = fromLocalSecs(local, int(_tz * time_zone_coef));
 }
 
 FlashDateTime::FlashDateTime(QDateTime qdt)
+    : FlashDateTime(qdt.date().year(), qdt.date().month(),
+                    qdt.date().day(), qdt.time().hour(),
+                    qdt.time().minute(), qdt.time().second(),
+                    1.0 * qdt.offsetFromUtc() / 3600)
 {
-  year  = qdt.date().year();
-  month = qdt.date().month();
-  day   = qdt.date().day();
-  hour  = qdt.time().hour();
-  min   = qdt.time().minute();
-  sec   = qdt.time().second();
-  setTimeZone(1.0 * qdt.offsetFromUtc() / 3600);
 }
 
 int FlashDateTime::getYear() const
 {
-  return year;
+  int y, m, d, h, mi, s;
+  getFields(y, m, d, h, mi, s);
+  return y;
 }
 
 int FlashDateTime::getMonth() const
 {
-  return month;
+  int y, m, d, h, mi, s;
+  getFields(y, m, d, h, mi, s);
+  return m;
 }
 
 int FlashDateTime::getDay() const
 {
-  return day;
+  int y, m, d, h, mi, s;
+  getFields(y, m, d, h, mi, s);
+  return d;
 }
 
 int FlashDateTime::getHour() const
 {
-  return hour;
+  int y, m, d, h, mi, s;
+  getFields(y, m, d, h, mi, s);
+  return h;
 }
 
 int FlashDateTime::getMin() const
 {
-  return min;
+  int y, m, d, h, mi, s;
+  getFields(y, m, d, h, mi, s);
+  return mi;
 }
 
 int FlashDateTime::getSec() const
 {
-  return sec;
+  int y, m, d, h, mi, s;
+  getFields(y, m, d, h, mi, s);
+  return s;
 }
 
 double FlashDateTime::getTimeZone() const
 {
-  return (1.0 * int(tz)) / time_zone_coef;
+  return isValid() ? (1.0 * getTz()) / time_zone_coef : 0;
 }
 
 void FlashDateTime::setTimeZone(double v)
 {
-  tz = int(v * time_zone_coef);
+  if (isValid())
+    *this = fromLocalSecs(getLocalSecs(), int(v * time_zone_coef));
 }
 
 bool FlashDateTime::isEqual(const FlashDateTime& v) const
 {
-  return year == v.year && month == v.month && day == v.day &&
-         hour == v.hour && min == v.min && sec == v.sec && tz == v.tz;
+  return packed == v.packed;
+}
+
+bool FlashDateTime::operator==(const FlashDateTime& v) const
+{
+  return packed == v.packed;
+}
+
+bool FlashDateTime::operator<(const FlashDateTime& v) const
+{
+  return packed < v.packed;
 }
 
 QString FlashDateTime::toString(QString format) const
@@ -111,52 +210,209 @@ QString FlashDateTime::toString(QString format) const
     return toQDateTime(*this).toString(format);
 }
 
+static bool parseField(const char* data, int size, int pos, int len,
+                       double& field)
+{
+  auto begin = data + std::min(pos, size);
+  auto end   = data + std::min(pos + len, size);
+  while (begin < end && *begin == ' ')
+    begin++;
+  while (end > begin && end[-1] == ' ')
+    end--;
+  if (begin == end)
+    return true;
+  double sign = 1;
+  if (begin < end && (*begin == '-' || *begin == '+'))
+    sign = *begin++ == '-' ? -1 : 1;
+  double value      = 0;
+  double scale      = 0;
+  int    digit_count = 0;
+  for (; begin < end; begin++)
+  {
+    if (*begin == '.' && scale == 0)
+      scale = 1;
+    else if (*begin >= '0' && *begin <= '9')
+    {
+      value = value * 10 + (*begin - '0');
+      scale *= 10;
+      digit_count++;
+    }
+    else
+      return false;
+  }
+  if (digit_count == 0)
+    return false;
+  field = sign * (scale > 1 ? value / scale : value);
+  return true;
+}
+
 FlashDateTime FlashDateTime::fromString(QString str)
 {
-  FlashDateTime dt;
-  dt.year  = str.mid(0, 4).toDouble();
-  dt.month = str.mid(5, 2).toDouble();
-  dt.day   = str.mid(8, 2).toDouble();
-  dt.hour  = str.mid(11, 2).toDouble();
-  dt.min   = str.mid(14, 2).toDouble();
-  dt.sec   = str.mid(17, 2).toDouble();
-  dt.setTimeZone(str.mid(20, 4).toDouble());
-  return dt;
+  auto ba = str.toUtf8();
+  return fromUtf8(ba.constData(), ba.count());
+}
+
+FlashDateTime FlashDateTime::fromUtf8(const char* data, int size)
+{
+  static constexpr int field_pos[] = {0, 5, 8, 11, 14, 17, 20};
+  static constexpr int field_len[] = {4, 2, 2, 2, 2, 2, 4};
+  double               f[]         = {0, 1, 1, 0, 0, 0, 0};
+  for (int i = 0; i < 7; i++)
+    if (!parseField(data, size, field_pos[i], field_len[i], f[i]))
+      return FlashDateTime();
+  int y = f[0];
+  int m = f[1];
+  int d = f[2];
+  if (m < 1 || m > 12 || d < 1 ||
+      d > daysFromCivil(y + m / 12, m % 12 + 1, 1) -
+              daysFromCivil(y, m, 1) ||
+      f[3] < 0 || f[3] > 23 || f[4] < 0 || f[4] > 59 || f[5] < 0 ||
+      f[5] > 59)
+    return FlashDateTime();
+  return FlashDateTime(y, m, d, f[3], f[4], f[5], f[6]);
+}
+
+QVector<FlashDateTime> FlashDateTime::fromStrings(const QStringList& list)
+{
+  QVector<FlashDateTime> ret(list.count());
+  QByteArray             ba;
+  for (int i = 0; i < list.count(); i++)
+  {
+    ba = list.at(i).toUtf8();
+    ret[i] = fromUtf8(ba.constData(), ba.count());
+  }
+  return ret;
+}
+
+QVector<FlashDateTime>
+FlashDateTime::fromUtf8List(const QVector<QByteArray>& list)
+{
+  QVector<FlashDateTime> ret(list.count());
+  for (int i = 0; i < list.count(); i++)
+    ret[i] = fromUtf8(list.at(i).constData(), list.at(i).count());
+  return ret;
 }
 
 bool FlashDateTime::isValid() const
 {
-  return (bool)year;
+  return packed != invalid;
 }
 
 int FlashDateTime::secsTo(FlashDateTime v) const
 {
-  QDateTime dt1 = toQDateTime(*this);
-  dt1           = dt1.addSecs(-getTimeZone() * 3600);
-  QDateTime dt2 = toQDateTime(v);
-  dt2           = dt2.addSecs(-v.getTimeZone() * 3600);
-  return dt1.secsTo(dt2);
+  return v.getUtcSecs() - getUtcSecs();
 }
 
 int FlashDateTime::secsToWithoutTZ(FlashDateTime v) const
 {
-  QDateTime dt1 = toQDateTime(*this);
-  QDateTime dt2 = toQDateTime(v);
-  return dt1.secsTo(dt2);
+  return v.getLocalSecs() - getLocalSecs();
 }
 
 FlashDateTime FlashDateTime::addDays(int days)
 {
-  QDateTime dt1 = toQDateTime(*this);
-  QDateTime dt2 = dt1.addDays(days);
-  return fromQDateTime(dt2, getTimeZone());
+  if (!isValid())
+    return *this;
+  return fromLocalSecs(getLocalSecs() + days * secs_per_day, getTz());
 }
 
 FlashDateTime FlashDateTime::addSecs(int secs)
 {
-  QDateTime dt1 = toQDateTime(*this);
-  QDateTime dt2 = dt1.addSecs(secs);
-  return fromQDateTime(dt2, getTimeZone());
+  if (!isValid())
+    return *this;
+  return fromLocalSecs(getLocalSecs() + secs, getTz());
+}
+
+static FlashDateTime fromStringReference(QString str)
+{
+  return FlashDateTime(
+      str.mid(0, 4).toDouble(), str.mid(5, 2).toDouble(),
+      str.mid(8, 2).toDouble(), str.mid(11, 2).toDouble(),
+      str.mid(14, 2).toDouble(), str.mid(17, 2).toDouble(),
+      str.mid(20, 4).toDouble());
+}
+
+int FlashDateTime::validate(int sample_count)
+{
+  QRandomGenerator rand(1);
+  auto*            rnd            = &rand;
+  auto             randomDateTime = [rnd]()
+  {
+    return FlashDateTime(rnd->bounded(1900, 2100), rnd->bounded(1, 13),
+                         rnd->bounded(1, 29), rnd->bounded(24),
+                         rnd->bounded(60), rnd->bounded(60),
+                         rnd->bounded(-48, 49) / 4.0);
+  };
+
+  int         mismatch_count = 0;
+  QStringList strings;
+  for (int i = 0; i < sample_count; i++)
+  {
+    auto a    = randomDateTime();
+    auto b    = randomDateTime();
+    int  days = rnd->bounded(-100000, 100000);
+    int  secs = rnd->bounded(-100000000, 100000000);
+    auto qa   = toQDateTime(a);
+    auto qb   = toQDateTime(b);
+    auto str  = a.toString();
+    strings.append(str);
+
+    if (!fromString(str).isEqual(fromStringReference(str)) ||
+        a.secsTo(b) !=
+            qa.addSecs(-a.getTimeZone() * 3600)
+                .secsTo(qb.addSecs(-b.getTimeZone() * 3600)) ||
+        a.secsToWithoutTZ(b) != qa.secsTo(qb) ||
+        !a.addDays(days).isEqual(
+            fromQDateTime(qa.addDays(days), a.getTimeZone())) ||
+        !a.addSecs(secs).isEqual(
+            fromQDateTime(qa.addSecs(secs), a.getTimeZone())))
+      mismatch_count++;
+  }
+
+  struct Sample
+  {
+    const char* str;
+    int         y, m, d, h, mi, s;
+  };
+  static const Sample partial_samples[] = {
+      {"2020", 2020, 1, 1, 0, 0, 0},
+      {"2020-05", 2020, 5, 1, 0, 0, 0},
+      {"2020-12-31", 2020, 12, 31, 0, 0, 0},
+      {"2020-05-07T10", 2020, 5, 7, 10, 0, 0},
+      {"2020-05-07T10:30", 2020, 5, 7, 10, 30, 0},
+      {"2024-02-29T23:59:59", 2024, 2, 29, 23, 59, 59}};
+  for (auto& sample: partial_samples)
+    if (!fromString(sample.str)
+             .isEqual(FlashDateTime(sample.y, sample.m, sample.d,
+                                    sample.h, sample.mi, sample.s, 0)))
+      mismatch_count++;
+  static const char* malformed_samples[] = {
+      "",
+      "abcd",
+      "20x0-01-01",
+      "2020-00-10",
+      "2020-13-01",
+      "2020-ab-01",
+      "2023-02-29",
+      "2020-05-32",
+      "2020-05-07T24:00",
+      "2020-05-07T10:60",
+      "2020-05-07T10:30:61"};
+  for (auto str: malformed_samples)
+    if (fromString(str).isValid())
+      mismatch_count++;
+
+  QElapsedTimer t;
+  t.start();
+  auto   parsed   = fromStrings(strings);
+  double parse_ns = 1.0 * t.nsecsElapsed() / strings.count();
+  t.restart();
+  for (auto& str: strings)
+    fromStringReference(str);
+  double reference_ns = 1.0 * t.nsecsElapsed() / strings.count();
+  qDebug() << "datetime:" << sample_count << "samples," << mismatch_count
+           << "mismatches, parse" << parse_ns << "ns vs" << reference_ns
+           << "ns";
+  return mismatch_count;
 }
 
 QTime FlashDateTime::str2time(QString str)
@@ -1,18 +1,22 @@
 #pragma once
 
 #include <QDateTime>
+#include <limits>
 
 class FlashDateTime
 {
-  static constexpr int time_zone_coef = 4;
+  static constexpr int    time_zone_coef = 4;
+  static constexpr qint64 invalid = std::numeric_limits<qint64>::min();
 
-  short       year;
-  signed char month;
-  signed char day;
-  signed char hour;
-  signed char min;
-  signed char sec;
-  signed char tz;
+  qint64 packed = invalid;
+
+  static qint64        daysFromCivil(int y, int m, int d);
+  static void          civilFromDays(qint64 days, int& y, int& m, int& d);
+  static qint64        pack(qint64 utc_secs, int tz);
+  static FlashDateTime fromLocalSecs(qint64 secs, int tz);
+  int                  getTz() const;
+  qint64               getLocalSecs() const;
+  void getFields(int& y, int& m, int& d, int& h, int& mi, int& s) const;
 
 public:
   FlashDateTime();
@@ -27,9 +31,17 @@ public:
   int              getSec() const;
   double           getTimeZone() const;
   void             setTimeZone(double);
+  qint64           getUtcSecs() const;
+  qint64           getPacked() const;
+  static FlashDateTime fromPacked(qint64);
   bool             isEqual(const FlashDateTime&) const;
+  bool             operator==(const FlashDateTime&) const;
+  bool             operator<(const FlashDateTime&) const;
   QString          toString(QString format = QString()) const;
   static FlashDateTime fromString(QString);
+  static FlashDateTime fromUtf8(const char* data, int size);
+  static QVector<FlashDateTime> fromStrings(const QStringList&);
+  static QVector<FlashDateTime> fromUtf8List(const QVector<QByteArray>&);
   bool             isValid() const;
   int              secsTo(FlashDateTime) const;
   int              secsToWithoutTZ(FlashDateTime) const;
@@ -41,4 +53,5 @@ public:
   static QString   sec2str(int t);
   static QString   timezone2str(double t);
   static double    str2timezone(QString str);
+  static int       validate(int sample_count = 100000);
 };
@@ -1,35 +1,132 @@
 #include "flashimport.h"
 #include <QDebug>
+#include <QtConcurrent>
+#include <charconv>
 
 namespace flashimport
 {
-QVector<FlashGeoPolygon> loadPolyFile(QString poly_path)
+static bool isSpace(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+static const char* skipSpaces(const char* p, const char* end)
 {
-  QVector<FlashGeoPolygon> ret;
-  QFile                    f(poly_path);
+  while (p < end && isSpace(*p))
+    p++;
+  return p;
+}
+
+static bool parseDouble(const char*& p, const char* end, double& v)
+{
+  p = skipSpaces(p, end);
+  if (p < end && *p == '+')
+    p++;
+  auto res = std::from_chars(p, end, v);
+  if (res.ec != std::errc())
+    return false;
+  p = res.ptr;
+  return true;
+}
+
+Poly parsePolyFile(QString poly_path)
+{
+  Poly  ret;
+  QFile f(poly_path);
   if (!f.open(QIODevice::ReadOnly))
   {
     qDebug() << "Error opening" << poly_path;
     return ret;
   }
-  QTextStream     in(&f);
-  FlashGeoPolygon curr_polygon;
-  while (!in.atEnd())
+  auto size = f.size();
+  auto data = size > 0 ? (const char*)f.map(0, size) : nullptr;
+  if (!data)
+    return ret;
+
+  QVector<FlashGeoPolygon> outer;
+  QVector<FlashGeoPolygon> inner;
+  FlashGeoPolygon          curr_polygon;
+  bool                     has_name   = false;
+  bool                     in_section = false;
+  bool                     is_hole    = false;
+  const char*              end        = data + size;
+  for (const char* p = data; p < end;)
   {
-    auto line  = in.readLine();
-    auto items = line.split(' ', Qt::SkipEmptyParts);
-    if (items.count() == 2)
+    auto line_end = (const char*)memchr(p, '\n', end - p);
+    if (!line_end)
+      line_end = end;
+    auto line_start = skipSpaces(p, line_end);
+    auto line_stop  = line_end;
+    while (line_stop > line_start && isSpace(line_stop[-1]))
+      line_stop--;
+    p = line_end + 1;
+
+    if (line_start == line_stop)
+      continue;
+
+    if (!has_name)
     {
-      double lon = items.at(0).toDouble();
-      double lat = items.at(1).toDouble();
-      curr_polygon.append(FlashGeoCoor().fromDegs(lat, lon));
+      ret.name = QString::fromUtf8(line_start, line_stop - line_start);
+      has_name = true;
+      continue;
     }
-    else if (!curr_polygon.isEmpty())
+
+    bool is_end =
+        line_stop - line_start == 3 && memcmp(line_start, "END", 3) == 0;
+    if (!in_section)
     {
-      ret.append(curr_polygon);
+      if (is_end)
+        break;
+      in_section = true;
+      is_hole    = *line_start == '!';
       curr_polygon.clear();
+      continue;
     }
+
+    if (is_end)
+    {
+      if (!curr_polygon.isEmpty())
+        (is_hole ? inner : outer).append(curr_polygon);
+      in_section = false;
+      continue;
+    }
+
+    auto   s   = line_start;
+    double lon = 0;
+    double lat = 0;
+    if (parseDouble(s, line_stop, lon) &&
+        parseDouble(s, line_stop, lat))
+      curr_polygon.append(FlashGeoCoor::fromDegs(lat, lon));
+    else
+      qDebug() << "error parsing" << poly_path << ":"
+               << QByteArray(line_start, line_stop - line_start);
+  }
+  f.unmap((uchar*)data);
+
+  ret.polygons = outer;
+  if (!inner.isEmpty())
+  {
+    ret.inner_polygon_start_idx = outer.count();
+    ret.polygons.append(inner);
   }
   return ret;
 }
+
+QVector<FlashGeoPolygon> loadPolyFile(QString poly_path)
+{
+  auto poly = parsePolyFile(poly_path);
+  if (poly.inner_polygon_start_idx >= 0)
+    poly.polygons.resize(poly.inner_polygon_start_idx);
+  return poly.polygons;
+}
+
+QVector<Poly> loadPolyFiles(const QStringList& poly_paths,
+                            int                thread_count)
+{
+  QThreadPool pool;
+  pool.setMaxThreadCount(std::max(1, thread_count));
+  return QtConcurrent::blockingMapped<QVector<Poly>>(
+      &pool, poly_paths,
+      [](const QString& poly_path) { return parsePolyFile(poly_path); });
+}
 }
@@ -1,8 +1,20 @@
 #pragma once
 
 #include "flashbase.h"
+#include <QThread>
 
 namespace flashimport
 {
+struct Poly
+{
+  QString                  name;
+  QVector<FlashGeoPolygon> polygons;
+  int                      inner_polygon_start_idx = -1;
+};
+
 QVector<FlashGeoPolygon> loadPolyFile(QString poly_path);
+Poly                     parsePolyFile(QString poly_path);
+QVector<Poly>            loadPolyFiles(
+               const QStringList& poly_paths,
+               int thread_count = QThread::idealThreadCount());
 }
@@ -5,120 +5,1892 @@
 #include <QElapsedTimer>
 #include <QDateTime>
 #include <QRegularExpression>
+#include <QSet>
+#include <QCryptographicHash>
+#include <QFileInfo>
+#include <QBuffer>
+#include <QtConcurrent>
+#include <numeric>
+#include <cstdio>
+#ifdef FLASHMAP_USE_IO_URING
+#include <liburing.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 bool FlashMap::ObjectAddress::isValid() const
 {
   return (tile_idx >= 0 && obj_idx >= 0);
 }
 
+qint64 FlashMap::ObjectAddress::getKey() const
+{
+  return (qint64(tile_idx) << 32) | quint32(obj_idx);
+}
+
+bool FlashMap::ObjectAddress::operator==(const ObjectAddress& v) const
+{
+  return tile_idx == v.tile_idx && obj_idx == v.obj_idx;
+}
+
 FlashMap::FlashMap(const QString& path)
 {
     this->path = path;
 }
 
-FlashMap::FlashMap(const QString& path, Settings v)
+FlashMap::FlashMap(const QString& path, Settings v)
+{
+  this->path = path;
+  settings = v;
+}
+
+void FlashMap::clear()
+{
+  if (main.status != VectorTile::Loaded)
+    return;
+  if (main.status == VectorTile::Loading)
+    return;
+
+  main.clear();
+  main.clearDrawOrder();
+  generation++;
+  tiles.clear();
+  tile_infos.clear();
+  forwarding.clear();
+  overfull_tiles.clear();
+  id_edits.clear();
+  id_index.clear();
+  id_index_loaded = false;
+  id_index_pos    = 0;
+  id_index_count  = 0;
+  classes_section = Section();
+  main_section    = Section();
+  borders_section = Section();
+  base_size       = 0;
+  classes_dirty   = false;
+  layout_dirty    = false;
+  classes.clear();
+  main.status = VectorTile::Null;
+  updateMemoryUsage();
+}
+
+qint64 FlashMap::getMemoryUsage() const
+{
+  qint64 total_size = 0;
+  for (int tile_idx = 0; tile_idx <= tiles.count(); tile_idx++)
+  {
+    auto& tile = tile_idx == 0 ? main : tiles.at(tile_idx - 1);
+    total_size += sizeof(VectorTile) + tile.data.capacity() +
+                  tile.capacity() * sizeof(FlashObject) +
+                  (tile.obj_pos.capacity() + tile.attr_pos.capacity()) *
+                      sizeof(int) +
+                  tile.home.capacity() * sizeof(ObjectAddress);
+    for (auto& obj: tile)
+      for (auto& polygon: obj.polygons)
+        total_size += polygon.capacity() * sizeof(FlashGeoCoor);
+  }
+  for (auto& border: borders)
+    total_size += border.capacity() * sizeof(FlashGeoCoor);
+  return total_size;
+}
+
+void FlashMap::updateMemoryUsage()
+{
+  memory_usage.storeRelaxed(getMemoryUsage());
+}
+
+qint64 FlashMap::getLastMemoryUsage() const
+{
+  return memory_usage.loadRelaxed();
+}
+
+qint64 FlashMap::count() const
+{
+  qint64 total_count = main.count();
+  for (auto t: tiles)
+    total_count += t.count();
+  return total_count;
+}
+
+void FlashMap::save()
+{
+  if (main_section.pos > 0 && QFile::exists(path))
+  {
+    auto new_borders = borders;
+    loadAll();
+    if (layout_dirty)
+      borders = new_borders;
+  }
+  dropTombstones();
+  auto tmp_path = path + ".tmp";
+  save(tmp_path);
+  if (std::rename(QFile::encodeName(tmp_path).constData(),
+                  QFile::encodeName(path).constData()) != 0)
+  {
+    qDebug() << "write error:" << path;
+    return;
+  }
+  QFile f(path);
+  if (!f.open(QIODevice::ReadOnly) || !loadFooter(&f))
+    return;
+  clearDirty();
+}
+
+void FlashMap::save(const QString& path) const
+{
+  using namespace FlashSerialize;
+
+  QFile f(path);
+  if (!f.open(QIODevice::ReadWrite | QIODevice::Truncate))
+  {
+    qDebug() << "write error:" << path;
+    return;
+  }
+
+  write(&f, QString("flashmap"));
+  write(&f, format_version);
+  write(&f, settings.compression_policy);
+  write(&f, settings.main_mip);
+  write(&f, settings.tile_mip);
+
+  Section borders_section;
+  if (!borders.isEmpty())
+  {
+    QByteArray    ba;
+    FlashTopology topology;
+    auto          border_refs =
+        topology.build(borders, border_coor_precision_coef);
+    write(ba, int(borders.count()));
+    topology.save(ba);
+    for (auto& refs: border_refs)
+      write(ba, refs);
+    if (settings.compression_policy == CompressionOn)
+      ba = qCompress(ba, 9);
+    borders_section = writeSection(&f, ba);
+  }
+
+  auto classes_section = writeClasses(&f);
+  auto main_section    = writeSection(&f, packTile(main));
+
+  QVector<int>     tile_order(tiles.count());
+  QVector<quint64> tile_keys(tiles.count());
+  std::iota(tile_order.begin(), tile_order.end(), 0);
+  for (int tile_idx = 0; tile_idx < tiles.count(); tile_idx++)
+    tile_keys[tile_idx] =
+        getHilbertKey(tile_infos.value(tile_idx).bounds);
+  std::stable_sort(tile_order.begin(), tile_order.end(),
+                   [&tile_keys](int a, int b)
+                   { return tile_keys.at(a) < tile_keys.at(b); });
+
+  QVector<TileInfo> infos(tiles.count());
+  for (auto tile_idx: tile_order)
+  {
+    auto& tile       = tiles.at(tile_idx);
+    auto  info       = getTileInfo(tile);
+    auto  section    = writeSection(&f, packTile(tile));
+    info.pos         = section.pos;
+    info.size        = section.size;
+    info.hash        = section.hash;
+    info.first_child = tile_infos.value(tile_idx).first_child;
+    info.bounds      = tile_infos.value(tile_idx).bounds;
+    infos[tile_idx]  = info;
+  }
+
+  writeFooter(&f, infos, (classes.count() + 63) / 64, classes_section,
+              main_section, borders_section, f.pos(), buildIdIndex());
+}
+
+void FlashMap::saveChanges()
+{
+  using namespace FlashSerialize;
+  if (layout_dirty || main_section.pos == 0 || !QFile::exists(path))
+  {
+    save();
+    return;
+  }
+
+  QFile f(path);
+  if (!f.open(QIODevice::ReadWrite))
+  {
+    qDebug() << "write error:" << path;
+    return;
+  }
+  f.seek(f.size());
+
+  if (classes_dirty)
+    classes_section = writeClasses(&f);
+  if (main.dirty)
+    main_section = writeSection(&f, packTile(main));
+  for (int tile_idx = -1; auto& tile: tiles)
+  {
+    tile_idx++;
+    if (!tile.dirty)
+      continue;
+    if (tile.status != VectorTile::Loaded)
+    {
+      qDebug() << "dirty tile not loaded, skipped:" << tile_idx;
+      continue;
+    }
+    auto info        = getTileInfo(tile);
+    auto section     = writeSection(&f, packTile(tile));
+    info.pos         = section.pos;
+    info.size        = section.size;
+    info.hash        = section.hash;
+    info.first_child = tile_infos.at(tile_idx).first_child;
+    info.bounds      = tile_infos.at(tile_idx).bounds;
+    tile_infos[tile_idx] = info;
+  }
+
+  loadIdIndex();
+  QMap<qint64, ObjectAddress> ids;
+  for (auto& entry: id_index)
+    ids.insert(entry.id, entry.addr);
+  for (auto it = id_edits.begin(); it != id_edits.end(); it++)
+    if (it.value().isValid())
+      ids.insert(it.key(), it.value());
+    else
+      ids.remove(it.key());
+  id_index.clear();
+  for (auto it = ids.begin(); it != ids.end(); it++)
+    id_index.append({it.key(), it.value()});
+
+  id_index_pos   = f.pos();
+  id_index_count = id_index.count();
+  writeFooter(&f, tile_infos, (classes.count() + 63) / 64,
+              classes_section, main_section, borders_section, base_size,
+              id_index);
+  id_edits.clear();
+  clearDirty();
+
+  if (f.size() > base_size * compaction_ratio)
+  {
+    f.close();
+    compact();
+  }
+}
+
+void FlashMap::compact()
+{
+  loadAll();
+  save();
+}
+
+bool FlashMap::isDirty() const
+{
+  if (layout_dirty || classes_dirty || main.dirty)
+    return true;
+  for (auto& tile: tiles)
+    if (tile.dirty)
+      return true;
+  return !id_edits.isEmpty();
+}
+
+int FlashMap::getGeneration() const
+{
+  return generation;
+}
+
+void FlashMap::clearDirty()
+{
+  generation++;
+  layout_dirty  = false;
+  classes_dirty = false;
+  main.dirty    = false;
+  for (auto& tile: tiles)
+    tile.dirty = false;
+}
+
+QSharedPointer<const FlashMap> FlashMap::snapshot() const
+{
+  loadIdIndex();
+  return QSharedPointer<FlashMap>::create(*this);
+}
+
+QSharedPointer<const FlashMap> FlashMap::pin() const
+{
+  if (!published)
+    return {};
+  QMutexLocker locker(&published->mutex);
+  return published->map;
+}
+
+void FlashMap::publish()
+{
+  auto map = snapshot();
+  if (!published)
+    return;
+  QMutexLocker locker(&published->mutex);
+  published->map = map;
+}
+
+FlashMap::Section FlashMap::writeSection(QFile*            f,
+                                         const QByteArray& ba) const
+{
+  Section section;
+  section.pos  = f->pos();
+  section.size = ba.count();
+  section.hash = QCryptographicHash::hash(ba, QCryptographicHash::Sha1);
+  f->write(ba.data(), ba.count());
+  return section;
+}
+
+void FlashMap::Section::save(QByteArray& ba) const
+{
+  using namespace FlashSerialize;
+  write(ba, pos);
+  write(ba, size);
+  write(ba, hash);
+}
+
+void FlashMap::Section::load(FlashSerialize::Cursor& c)
+{
+  using namespace FlashSerialize;
+  read(c, pos);
+  read(c, size);
+  read(c, hash);
+}
+
+FlashMap::Section FlashMap::writeClasses(QFile* f) const
+{
+  using namespace FlashSerialize;
+  Section section;
+  section.pos = f->pos();
+  write(f, int(classes.count()));
+  for (auto& cl: classes)
+    cl.save(f);
+  section.size = f->pos() - section.pos;
+  f->seek(section.pos);
+  section.hash = QCryptographicHash::hash(f->read(section.size),
+                                          QCryptographicHash::Sha1);
+  return section;
+}
+
+void FlashMap::writeFooter(QFile* f, const QVector<TileInfo>& infos,
+                           int mask_word_count, const Section& classes,
+                           const Section& main, const Section& borders,
+                           qint64                       base_size,
+                           const QVector<IdIndexEntry>& id_entries) const
+{
+  using namespace FlashSerialize;
+  auto id_index_pos = f->pos();
+  for (auto& entry: id_entries)
+  {
+    write(f, entry.id);
+    write(f, entry.addr.tile_idx);
+    write(f, entry.addr.obj_idx);
+  }
+
+  auto       footer_pos = f->pos();
+  QByteArray ba;
+  write(ba, int(infos.count()));
+  write(ba, mask_word_count);
+  write(ba, grid_frame.top_left);
+  write(ba, grid_frame.bottom_right);
+  write(ba, tile_side_num);
+  classes.save(ba);
+  main.save(ba);
+  borders.save(ba);
+  write(ba, base_size);
+  for (auto& info: infos)
+    info.save(ba, mask_word_count);
+  write(ba, int(forwarding.count()));
+  for (auto it = forwarding.begin(); it != forwarding.end(); it++)
+  {
+    write(ba, it.key());
+    write(ba, it.value().tile_idx);
+    write(ba, it.value().obj_idx);
+  }
+  write(ba, id_index_pos);
+  write(ba, int(id_entries.count()));
+  f->write(ba.data(), ba.count());
+  write(f, footer_pos);
+}
+
+bool FlashMap::loadFooter(QFile* f)
+{
+  using namespace FlashSerialize;
+  qint64 footer_pos = 0;
+  f->seek(f->size() - sizeof(qint64));
+  read(f, footer_pos);
+  generation++;
+  if (footer_pos < 0 || footer_pos > f->size() - qint64(sizeof(qint64)))
+  {
+    qDebug() << "footer error:" << path;
+    return false;
+  }
+  f->seek(footer_pos);
+  auto   footer_ba = f->read(f->size() - sizeof(qint64) - footer_pos);
+  Cursor c(footer_ba);
+  int    info_count      = 0;
+  int    mask_word_count = 0;
+  read(c, info_count);
+  read(c, mask_word_count);
+  read(c, grid_frame.top_left);
+  read(c, grid_frame.bottom_right);
+  read(c, tile_side_num);
+  classes_section.load(c);
+  main_section.load(c);
+  borders_section.load(c);
+  read(c, base_size);
+  if (!c.check(info_count, 1) || classes_section.pos <= 0 ||
+      main_section.pos <= 0)
+  {
+    qDebug() << "footer error:" << path;
+    return false;
+  }
+  tile_infos.resize(info_count);
+  for (auto& info: tile_infos)
+    info.load(c, mask_word_count);
+  int forwarding_count = 0;
+  read(c, forwarding_count);
+  forwarding.clear();
+  if (!c.check(forwarding_count, sizeof(qint64) + sizeof(int) * 2))
+    forwarding_count = 0;
+  for (int i = 0; i < forwarding_count; i++)
+  {
+    qint64        key = 0;
+    ObjectAddress addr;
+    read(c, key);
+    read(c, addr.tile_idx);
+    read(c, addr.obj_idx);
+    forwarding.insert(key, addr);
+  }
+  read(c, id_index_pos);
+  read(c, id_index_count);
+  if (!c.ok || id_index_count < 0)
+  {
+    qDebug() << "footer error: truncated footer in" << path;
+    tile_infos.clear();
+    forwarding.clear();
+    id_index_count = 0;
+    return false;
+  }
+  id_index.clear();
+  id_index_loaded = false;
+  id_edits.clear();
+  return true;
+}
+
+bool FlashMap::loadHeader(QFile* f)
+{
+  using namespace FlashSerialize;
+  QString format_id;
+  read(f, format_id);
+  int version = 0;
+  read(f, version);
+  if (format_id != "flashmap")
+  {
+    qDebug() << "unsupported format:" << path << format_id;
+    return false;
+  }
+  if (version != format_version)
+  {
+    qDebug() << "unsupported format version" << version << "in" << path
+             << "- expected" << format_version
+             << ", rebuild the map from its source data";
+    return false;
+  }
+  read(f, settings.compression_policy);
+  read(f, settings.main_mip);
+  read(f, settings.tile_mip);
+  return loadFooter(f);
+}
+
+bool FlashMap::createPatch(const QString& old_path,
+                           const QString& new_path,
+                           const QString& patch_path)
+{
+  using namespace FlashSerialize;
+  FlashMap old_map(old_path);
+  FlashMap new_map(new_path);
+  QFile    old_f(old_path);
+  QFile    new_f(new_path);
+  if (!old_f.open(QIODevice::ReadOnly) ||
+      !new_f.open(QIODevice::ReadOnly) || !old_map.loadHeader(&old_f) ||
+      !new_map.loadHeader(&new_f))
+  {
+    qDebug() << "patch error: cannot read" << old_path << new_path;
+    return false;
+  }
+  if (old_map.settings.compression_policy !=
+          new_map.settings.compression_policy ||
+      old_map.settings.main_mip != new_map.settings.main_mip ||
+      old_map.settings.tile_mip != new_map.settings.tile_mip)
+  {
+    qDebug() << "patch error: incompatible settings" << old_path
+             << new_path;
+    return false;
+  }
+
+  auto readSection = [](QFile& f, const Section& section)
+  {
+    f.seek(section.pos);
+    return f.read(section.size);
+  };
+
+  QByteArray ba;
+  write(ba, QString("flashpatch"));
+  write(ba, format_version);
+  write(ba, old_map.getContentHash());
+
+  const Section* old_sections[] = {&old_map.classes_section,
+                                   &old_map.main_section,
+                                   &old_map.borders_section};
+  const Section* new_sections[] = {&new_map.classes_section,
+                                   &new_map.main_section,
+                                   &new_map.borders_section};
+  for (int i = 0; i < 3; i++)
+  {
+    char changed = old_sections[i]->hash != new_sections[i]->hash;
+    write(ba, changed);
+    if (changed)
+      write(ba, readSection(new_f, *new_sections[i]));
+  }
+
+  QSet<QByteArray> old_hashes;
+  for (auto& info: old_map.tile_infos)
+    old_hashes.insert(info.hash);
+  int mask_word_count = 0;
+  for (auto& info: new_map.tile_infos)
+    mask_word_count =
+        std::max(mask_word_count, int(info.class_mask.count()));
+  write(ba, new_map.grid_frame.top_left);
+  write(ba, new_map.grid_frame.bottom_right);
+  write(ba, new_map.tile_side_num);
+  write(ba, mask_word_count);
+  write(ba, int(new_map.tile_infos.count()));
+  int changed_count = 0;
+  for (auto& info: new_map.tile_infos)
+  {
+    info.save(ba, mask_word_count);
+    char has_data = !old_hashes.contains(info.hash);
+    write(ba, has_data);
+    if (has_data)
+    {
+      write(ba, readSection(new_f, {info.pos, info.size, info.hash}));
+      changed_count++;
+    }
+  }
+
+  write(ba, int(new_map.forwarding.count()));
+  for (auto it = new_map.forwarding.begin();
+       it != new_map.forwarding.end(); it++)
+  {
+    write(ba, it.key());
+    write(ba, it.value().tile_idx);
+    write(ba, it.value().obj_idx);
+  }
+
+  qint64 entry_size = sizeof(qint64) + sizeof(int) * 2;
+  auto   old_ids    = readSection(
+      old_f, {old_map.id_index_pos,
+              old_map.id_index_count * entry_size, QByteArray()});
+  auto new_ids = readSection(
+      new_f, {new_map.id_index_pos, new_map.id_index_count * entry_size,
+              QByteArray()});
+  char ids_changed = old_ids != new_ids;
+  write(ba, ids_changed);
+  if (ids_changed)
+    write(ba, new_ids);
+
+  QFile f(patch_path);
+  if (!f.open(QIODevice::WriteOnly))
+  {
+    qDebug() << "write error:" << patch_path;
+    return false;
+  }
+  f.write(ba);
+  qDebug() << "patch:" << changed_count << "of"
+           << new_map.tile_infos.count() << "tiles changed," << ba.count()
+           << "bytes";
+  return true;
+}
+
+bool FlashMap::applyPatch(const QString& map_path,
+                          const QString& patch_path)
+{
+  using namespace FlashSerialize;
+  QFile patch_f(patch_path);
+  if (!patch_f.open(QIODevice::ReadOnly))
+  {
+    qDebug() << "read error:" << patch_path;
+    return false;
+  }
+  auto    ba = patch_f.readAll();
+  Cursor  c(ba);
+  QString format_id;
+  int     version = 0;
+  read(c, format_id);
+  read(c, version);
+  if (format_id != "flashpatch" || version != format_version)
+  {
+    qDebug() << "unsupported patch format:" << patch_path << format_id
+             << version;
+    return false;
+  }
+  QByteArray base_hash;
+  read(c, base_hash);
+
+  FlashMap map(map_path);
+  QFile    f(map_path);
+  if (!f.open(QIODevice::ReadWrite) || !map.loadHeader(&f))
+  {
+    qDebug() << "read error:" << map_path;
+    return false;
+  }
+  if (map.getContentHash() != base_hash)
+  {
+    qDebug() << "patch error: base version mismatch" << map_path;
+    return false;
+  }
+
+  QHash<QByteArray, TileInfo> old_infos;
+  for (auto& info: map.tile_infos)
+    old_infos.insert(info.hash, info);
+
+  char       section_changed[3] = {};
+  QByteArray section_data[3];
+  for (int i = 0; i < 3; i++)
+  {
+    read(c, section_changed[i]);
+    if (section_changed[i])
+      read(c, section_data[i]);
+  }
+
+  FlashGeoRect grid_frame;
+  int          tile_side_num   = 0;
+  int          mask_word_count = 0;
+  int          tile_count      = 0;
+  read(c, grid_frame.top_left);
+  read(c, grid_frame.bottom_right);
+  read(c, tile_side_num);
+  read(c, mask_word_count);
+  read(c, tile_count);
+  if (!c.check(mask_word_count, sizeof(quint64)) ||
+      !c.check(tile_count, 1))
+  {
+    qDebug() << "patch error: bad tile table" << patch_path;
+    return false;
+  }
+  QVector<TileInfo>   infos(tile_count);
+  QVector<char>       has_data(tile_count);
+  QVector<QByteArray> tile_data(tile_count);
+  for (int i = 0; i < tile_count && c.ok; i++)
+  {
+    infos[i].load(c, mask_word_count);
+    read(c, has_data[i]);
+    if (has_data.at(i))
+      read(c, tile_data[i]);
+    else if (old_infos.value(infos.at(i).hash).pos <= 0)
+    {
+      qDebug() << "patch error: missing tile data" << patch_path;
+      return false;
+    }
+  }
+
+  int forwarding_count = 0;
+  read(c, forwarding_count);
+  QHash<qint64, ObjectAddress> forwarding;
+  if (!c.check(forwarding_count, sizeof(qint64) + sizeof(int) * 2))
+    forwarding_count = 0;
+  for (int i = 0; i < forwarding_count; i++)
+  {
+    qint64        key = 0;
+    ObjectAddress addr;
+    read(c, key);
+    read(c, addr.tile_idx);
+    read(c, addr.obj_idx);
+    forwarding.insert(key, addr);
+  }
+
+  char                  ids_changed = false;
+  QVector<IdIndexEntry> id_index;
+  read(c, ids_changed);
+  if (ids_changed)
+  {
+    QByteArray data;
+    read(c, data);
+    Cursor data_c(data);
+    id_index.resize(data.count() / (sizeof(qint64) + sizeof(int) * 2));
+    for (auto& entry: id_index)
+    {
+      read(data_c, entry.id);
+      read(data_c, entry.addr.tile_idx);
+      read(data_c, entry.addr.obj_idx);
+    }
+  }
+  if (!c.ok)
+  {
+    qDebug() << "patch error: truncated patch" << patch_path;
+    return false;
+  }
+  if (!ids_changed)
+  {
+    map.loadIdIndex();
+    id_index = map.id_index;
+  }
+
+  f.seek(f.size());
+  Section* sections[] = {&map.classes_section, &map.main_section,
+                         &map.borders_section};
+  for (int i = 0; i < 3; i++)
+    if (section_changed[i])
+      *sections[i] = section_data[i].isEmpty()
+                         ? Section()
+                         : map.writeSection(&f, section_data[i]);
+  for (int i = 0; i < tile_count; i++)
+    if (has_data.at(i))
+      infos[i].pos = map.writeSection(&f, tile_data.at(i)).pos;
+    else
+      infos[i].pos = old_infos.value(infos.at(i).hash).pos;
+  map.grid_frame    = grid_frame;
+  map.tile_side_num = tile_side_num;
+  map.forwarding    = forwarding;
+  map.writeFooter(&f, infos, mask_word_count, map.classes_section,
+                  map.main_section, map.borders_section, map.base_size,
+                  id_index);
+
+  f.flush();
+  if (!map.loadFooter(&f) || map.tile_infos.count() != tile_count)
+  {
+    qDebug() << "patch error: footer reload failed" << map_path;
+    return false;
+  }
+  return true;
+}
+
+void FlashMap::benchmarkPatch(const QString& map_path,
+                              double         change_ratio)
+{
+  auto old_path    = map_path + ".bench_old";
+  auto new_path    = map_path + ".bench_new";
+  auto patch_path  = map_path + ".bench_patch";
+  auto target_path = map_path + ".bench_target";
+  for (auto& p: {old_path, new_path, patch_path, target_path})
+    QFile::remove(p);
+  QFile::copy(map_path, old_path);
+
+  FlashMap map(old_path);
+  map.loadAll();
+  int changed_count = 0;
+  int step          = std::max(1, int(1 / change_ratio));
+  for (int tile_idx = 0; tile_idx < map.tiles.count(); tile_idx += step)
+  {
+    auto& tile = map.tiles.at(tile_idx);
+    for (int obj_idx = 0; obj_idx < tile.count(); obj_idx++)
+    {
+      if (tile.at(obj_idx).isEmpty() || tile.getHome(obj_idx).isValid())
+        continue;
+      auto obj       = tile.at(obj_idx);
+      obj.attributes = tile.getAttributes(obj_idx);
+      obj.attributes.insert("patch_benchmark", "1");
+      map.setObject({tile_idx + 1, obj_idx}, obj);
+      changed_count++;
+      break;
+    }
+  }
+  map.save(new_path);
+
+  QElapsedTimer t;
+  t.start();
+  createPatch(old_path, new_path, patch_path);
+  double create_ms = t.nsecsElapsed() * 1E-6;
+  QFile::copy(old_path, target_path);
+  t.restart();
+  applyPatch(target_path, patch_path);
+  double apply_ms = t.nsecsElapsed() * 1E-6;
+
+  FlashMap new_map(new_path);
+  FlashMap target_map(target_path);
+  QFile    new_f(new_path);
+  QFile    target_f(target_path);
+  bool     is_equal =
+      new_f.open(QIODevice::ReadOnly) &&
+      target_f.open(QIODevice::ReadOnly) && new_map.loadHeader(&new_f) &&
+      target_map.loadHeader(&target_f) &&
+      new_map.getContentHash() == target_map.getContentHash();
+  qDebug() << "patch benchmark:" << changed_count << "objects in"
+           << map.tiles.count() << "tiles changed, patch"
+           << QFileInfo(patch_path).size() << "bytes, map"
+           << QFileInfo(new_path).size() << "bytes, create" << create_ms
+           << "ms, apply" << apply_ms << "ms,"
+           << (is_equal ? "verified" : "MISMATCH");
+  new_f.close();
+  target_f.close();
+  for (auto& p: {old_path, new_path, patch_path, target_path})
+    QFile::remove(p);
+}
+
+bool FlashMap::validateSaveChanges(const QString& map_path)
+{
+  auto test_path = map_path + ".validate";
+  QFile::remove(test_path);
+  QFile::copy(map_path, test_path);
+
+  auto countObjects = [](const FlashMap& map, qint64 id)
+  {
+    int count = 0;
+    for (auto& tile: map.tiles)
+      for (auto& obj: tile)
+        count += obj.id == id ? 1 : 0;
+    return count;
+  };
+
+  FlashMap old_map(test_path);
+  old_map.loadAll();
+  int old_count = old_map.getLoadedObjects().count();
+  int class_idx = -1;
+  for (int idx = 0; idx < old_map.classes.count(); idx++)
+  {
+    auto& cl = old_map.classes.at(idx);
+    if (cl.type == FlashClass::Line && cl.max_mip > 0 &&
+        cl.max_mip <= old_map.settings.tile_mip)
+      class_idx = idx;
+  }
+  if (class_idx < 0 || old_map.tiles.isEmpty())
+  {
+    qDebug() << "save changes validation: no tile class in" << map_path;
+    QFile::remove(test_path);
+    return false;
+  }
+
+  qint64   test_id = std::numeric_limits<qint64>::max();
+  FlashMap map(test_path);
+  map.loadMainVectorTile(true);
+  FlashObject obj;
+  obj.class_idx = class_idx;
+  obj.id        = test_id;
+  obj.polygons.append({});
+  obj.polygons[0].append(old_map.frame.top_left);
+  obj.polygons[0].append(old_map.frame.bottom_right);
+  obj.frame   = obj.polygons.first().getFrame();
+  auto addr   = map.addObject(obj);
+  int  copies = countObjects(map, test_id);
+  map.saveChanges();
+
+  FlashMap new_map(test_path);
+  new_map.loadAll();
+  int  new_count  = new_map.getLoadedObjects().count();
+  int  new_copies = countObjects(new_map, test_id);
+  bool is_valid   = addr.isValid() && new_count == old_count + 1 &&
+                   new_copies == copies;
+  qDebug() << "save changes validation:" << old_count << "->"
+           << new_count << "objects," << copies << "->" << new_copies
+           << "copies," << (is_valid ? "verified" : "MISMATCH");
+  QFile::remove(test_path);
+  return is_valid;
+}
+
+QByteArray FlashMap::getContentHash() const
+{
+  QCryptographicHash hash(QCryptographicHash::Sha1);
+  hash.addData(classes_section.hash);
+  hash.addData(main_section.hash);
+  hash.addData(borders_section.hash);
+  for (auto& info: tile_infos)
+    hash.addData(info.hash);
+  return hash.result();
+}
+
+static QByteArray packTileBlock(const QVector<QByteArray>& obj_ba_list,
+                                const QVector<QByteArray>& attr_ba_list,
+                                const QByteArray&          topology_ba)
+{
+  using namespace FlashSerialize;
+  int obj_start = sizeof(int) + topology_ba.count() +
+                  obj_ba_list.count() * sizeof(int) * 2;
+  int obj_size  = 0;
+  for (auto& obj_ba: obj_ba_list)
+    obj_size += obj_ba.count();
+
+  QByteArray ba;
+  write(ba, topology_ba);
+  int obj_pos  = obj_start;
+  int attr_pos = obj_start + obj_size;
+  for (int i = 0; i < obj_ba_list.count(); i++)
+  {
+    write(ba, obj_pos);
+    write(ba, attr_pos);
+    obj_pos += obj_ba_list.at(i).count();
+    attr_pos += attr_ba_list.at(i).count();
+  }
+  for (auto& obj_ba: obj_ba_list)
+    ba.append(obj_ba);
+  for (auto& attr_ba: attr_ba_list)
+    ba.append(attr_ba);
+  return ba;
+}
+
+QByteArray FlashMap::packTopology(const VectorTile& tile, int start,
+                                  int                  end,
+                                  QVector<QByteArray>& obj_ba_list) const
+{
+  QVector<FlashGeoPolygon> rings;
+  int                      topology_coef = 0;
+  auto isArea = [this](const FlashObject& obj)
+  {
+    return obj.class_idx >= 0 && !obj.isChunked() &&
+           classes.at(obj.class_idx).type == FlashClass::Area;
+  };
+  for (int obj_idx = start; obj_idx < end; obj_idx++)
+    if (auto& obj = tile.at(obj_idx); isArea(obj))
+    {
+      int coef = classes.at(obj.class_idx).coor_precision_coef;
+      rings.append(obj.polygons);
+      topology_coef =
+          topology_coef == 0 ? coef : std::min(topology_coef, coef);
+    }
+  if (rings.isEmpty())
+    return QByteArray();
+
+  FlashTopology topology;
+  auto          ring_refs = topology.build(rings, topology_coef);
+  int           ring_idx  = 0;
+  QByteArray    topology_ba;
+  topology.save(topology_ba);
+  QHash<int, QByteArray> topo_obj_ba_list;
+  qint64                 plain_size = 0;
+  qint64                 topo_size  = topology_ba.count();
+  for (int obj_idx = start; obj_idx < end; obj_idx++)
+    if (auto& obj = tile.at(obj_idx); isArea(obj))
+    {
+      auto obj_refs = ring_refs.mid(ring_idx, obj.polygons.count());
+      ring_idx += obj.polygons.count();
+      auto& obj_ba = topo_obj_ba_list[obj_idx];
+      obj.save(classes, obj_ba, &obj_refs);
+      plain_size += obj_ba_list.at(obj_idx).count();
+      topo_size += obj_ba.count();
+    }
+  if (topo_size >= plain_size)
+    return QByteArray();
+  for (auto it = topo_obj_ba_list.begin(); it != topo_obj_ba_list.end();
+       it++)
+    obj_ba_list[it.key()] = it.value();
+  return topology_ba;
+}
+
+QByteArray FlashMap::packTile(const VectorTile& tile) const
+{
+  using namespace FlashSerialize;
+  QByteArray tile_ba;
+  QVector<QByteArray> obj_ba_list;
+  QVector<QByteArray> attr_ba_list;
+  for (int obj_idx = -1; auto& obj: tile)
+  {
+    obj_idx++;
+    QByteArray obj_ba;
+    obj.save(classes, obj_ba);
+    obj_ba_list.append(obj_ba);
+    QByteArray attr_ba;
+    write(attr_ba, tile.getAttributes(obj_idx));
+    attr_ba_list.append(attr_ba);
+  }
+
+  int obj_count = obj_ba_list.count();
+  write(tile_ba, obj_count);
+  if (obj_count == 0)
+    return tile_ba;
+
+  QVector<int>        block_obj_counts;
+  QVector<QByteArray> blocks;
+  for (int start = 0; start < obj_count;)
+  {
+    int end        = start;
+    int block_size = 0;
+    while (end < obj_count &&
+           (end == start || block_size < block_size_limit))
+    {
+      block_size +=
+          obj_ba_list.at(end).count() + attr_ba_list.at(end).count();
+      end++;
+    }
+    auto topology_ba = packTopology(tile, start, end, obj_ba_list);
+    auto ba = packTileBlock(obj_ba_list.mid(start, end - start),
+                            attr_ba_list.mid(start, end - start),
+                            topology_ba);
+    if (settings.compression_policy == CompressionOn)
+      ba = qCompress(ba, 9);
+    block_obj_counts.append(end - start);
+    blocks.append(ba);
+    start = end;
+  }
+
+  write(tile_ba, int(blocks.count()));
+  for (int i = 0; i < blocks.count(); i++)
+  {
+    write(tile_ba, block_obj_counts.at(i));
+    write(tile_ba, int(blocks.at(i).count()));
+  }
+  for (auto& ba: blocks)
+    tile_ba.append(ba);
+
+  QVector<int> copy_idxs;
+  for (int obj_idx = 0; obj_idx < tile.home.count(); obj_idx++)
+    if (tile.home.at(obj_idx).isValid())
+      copy_idxs.append(obj_idx);
+  write(tile_ba, int(copy_idxs.count()));
+  for (auto obj_idx: copy_idxs)
+  {
+    write(tile_ba, obj_idx);
+    write(tile_ba, tile.home.at(obj_idx).tile_idx);
+    write(tile_ba, tile.home.at(obj_idx).obj_idx);
+  }
+
+  QVector<int> id_obj_idxs;
+  for (int obj_idx = 0; obj_idx < tile.count(); obj_idx++)
+    if (tile.at(obj_idx).id != 0)
+      id_obj_idxs.append(obj_idx);
+  write(tile_ba, int(id_obj_idxs.count()));
+  for (auto obj_idx: id_obj_idxs)
+  {
+    write(tile_ba, obj_idx);
+    write(tile_ba, tile.at(obj_idx).id);
+  }
+  return tile_ba;
+}
+
+bool FlashMap::loadTile(QIODevice* f, VectorTile& tile) const
+{
+  using namespace FlashSerialize;
+  tile.data.clear();
+  tile.obj_pos.clear();
+  tile.attr_pos.clear();
+  tile.clearDrawOrder();
+  auto fail = [this, &tile](const char* what)
+  {
+    qDebug() << "read error:" << what << "in" << path;
+    tile.clear();
+    tile.data.clear();
+    tile.obj_pos.clear();
+    tile.attr_pos.clear();
+    tile.home.clear();
+    return false;
+  };
+
+  int obj_count = 0;
+  read(f, obj_count);
+  if (obj_count < 0)
+    return fail("bad object count");
+  if (obj_count == 0)
+    return true;
+
+  int block_count = 0;
+  read(f, block_count);
+  if (block_count <= 0 || block_count > obj_count ||
+      qint64(block_count) * sizeof(int) * 2 > f->bytesAvailable())
+    return fail("bad block count");
+  QVector<int> block_obj_counts(block_count);
+  QVector<int> block_sizes(block_count);
+  qint64       total_obj_count = 0;
+  qint64       total_size      = 0;
+  for (int i = 0; i < block_count; i++)
+  {
+    read(f, block_obj_counts[i]);
+    read(f, block_sizes[i]);
+    if (block_obj_counts.at(i) < 0 || block_sizes.at(i) < 0)
+      return fail("bad block table");
+    total_obj_count += block_obj_counts.at(i);
+    total_size += block_sizes.at(i);
+  }
+  if (total_obj_count != obj_count || total_size > f->bytesAvailable())
+    return fail("bad block table");
+
+  QVector<FlashTopology> topologies(block_count);
+  for (int i = 0; i < block_count; i++)
+  {
+    QByteArray ba = f->read(block_sizes.at(i));
+    if (ba.count() != block_sizes.at(i))
+      return fail("truncated block");
+    if (settings.compression_policy == CompressionOn)
+      ba = qUncompress(ba);
+    int        base = tile.data.count();
+    Cursor     c(ba);
+    QByteArray topology_ba;
+    read(c, topology_ba);
+    topologies[i] = loadTopology(topology_ba);
+    if (!c.check(block_obj_counts.at(i), sizeof(int) * 2))
+      return fail("truncated block");
+    for (int j = 0; j < block_obj_counts.at(i); j++)
+    {
+      int obj_pos  = 0;
+      int attr_pos = 0;
+      read(c, obj_pos);
+      read(c, attr_pos);
+      if (obj_pos < 0 || obj_pos >= ba.count() || attr_pos < 0 ||
+          attr_pos > ba.count())
+        return fail("bad object offset");
+      tile.obj_pos.append(base + obj_pos);
+      tile.attr_pos.append(base + attr_pos);
+    }
+    tile.data.append(ba);
+  }
+
+  tile.resize(tile.obj_pos.count());
+  for (int i = 0, block_idx = 0, block_end = 0; i < tile.count(); i++)
+  {
+    while (block_idx < block_count && i >= block_end)
+      block_end += block_obj_counts.at(block_idx++);
+    Cursor c(tile.data, tile.obj_pos.at(i));
+    tile[i].load(classes, c, &topologies.at(block_idx - 1));
+    if (!c.ok)
+      qDebug() << "read error: truncated object" << i << "in" << path;
+  }
+
+  int copy_count = 0;
+  read(f, copy_count);
+  tile.home.clear();
+  if (copy_count > 0)
+    tile.home.resize(tile.count());
+  for (int i = 0; i < copy_count; i++)
+  {
+    int obj_idx = 0;
+    read(f, obj_idx);
+    if (obj_idx < 0 || obj_idx >= tile.count())
+      return fail("bad copy index");
+    read(f, tile.home[obj_idx].tile_idx);
+    read(f, tile.home[obj_idx].obj_idx);
+  }
+
+  int id_count = 0;
+  read(f, id_count);
+  for (int i = 0; i < id_count; i++)
+  {
+    int obj_idx = 0;
+    read(f, obj_idx);
+    if (obj_idx < 0 || obj_idx >= tile.count())
+      return fail("bad id index");
+    read(f, tile[obj_idx].id);
+  }
+  return true;
+}
+
+FlashTopology FlashMap::loadTopology(const QByteArray& ba) const
+{
+  FlashTopology topology;
+  if (ba.isEmpty())
+    return topology;
+  FlashSerialize::Cursor c(ba);
+  topology.load(c);
+  return topology;
+}
+
+static quint64 getHilbertIndex(quint32 x, quint32 y, int order)
+{
+  quint32 n = 1u << order;
+  quint64 d = 0;
+  for (quint32 s = n / 2; s > 0; s /= 2)
+  {
+    quint32 rx = (x & s) > 0;
+    quint32 ry = (y & s) > 0;
+    d += quint64(s) * s * ((3 * rx) ^ ry);
+    if (ry == 0)
+    {
+      if (rx == 1)
+      {
+        x = n - 1 - x;
+        y = n - 1 - y;
+      }
+      std::swap(x, y);
+    }
+  }
+  return d;
+}
+
+quint64 FlashMap::getHilbertKey(const FlashGeoRect& rect) const
+{
+  double side = (1u << hilbert_order) - 1;
+  double w    = std::max(1ll, qint64(frame.bottom_right.lon) -
+                                  frame.top_left.lon);
+  double h    = std::max(1ll, qint64(frame.bottom_right.lat) -
+                                  frame.top_left.lat);
+  double cx   = (qint64(rect.top_left.lon) + rect.bottom_right.lon) / 2.0;
+  double cy   = (qint64(rect.top_left.lat) + rect.bottom_right.lat) / 2.0;
+  double x    = std::clamp((cx - frame.top_left.lon) / w, 0.0, 1.0);
+  double y    = std::clamp((cy - frame.top_left.lat) / h, 0.0, 1.0);
+  return getHilbertIndex(x * side, y * side, hilbert_order);
+}
+
+qint64 FlashMap::getTilePos(int tile_idx) const
+{
+  if (tile_idx < 0 || tile_idx >= tile_infos.count())
+    return -1;
+  auto pos = tile_infos.at(tile_idx).pos;
+  return pos > 0 ? pos : -1;
+}
+
+QRect FlashMap::getTileRange(const FlashGeoRect& rect) const
+{
+  auto grid_size_m     = grid_frame.getSizeMeters();
+  auto grid_top_left_m = grid_frame.top_left.toMeters();
+  auto top_left_m      = rect.top_left.toMeters();
+  auto bottom_right_m  = rect.bottom_right.toMeters();
+  auto toCell          = [this](double shift_m, double size_m)
+  {
+    int cell = size_m > 0 ? shift_m / size_m * tile_side_num : 0;
+    return std::clamp(cell, 0, tile_side_num - 1);
+  };
+  return QRect(
+      QPoint(toCell(top_left_m.x() - grid_top_left_m.x(),
+                    grid_size_m.width()),
+             toCell(top_left_m.y() - grid_top_left_m.y(),
+                    grid_size_m.height())),
+      QPoint(toCell(bottom_right_m.x() - grid_top_left_m.x(),
+                    grid_size_m.width()),
+             toCell(bottom_right_m.y() - grid_top_left_m.y(),
+                    grid_size_m.height())));
+}
+
+FlashGeoRect FlashMap::getCellBounds(int x, int y) const
+{
+  auto         grid_m = grid_frame.toMeters();
+  double       w      = grid_m.width() / tile_side_num;
+  double       h      = grid_m.height() / tile_side_num;
+  FlashGeoRect bounds;
+  bounds.top_left = FlashGeoCoor::fromMeters(
+      {grid_m.left() + x * w, grid_m.top() + y * h});
+  bounds.bottom_right = FlashGeoCoor::fromMeters(
+      {grid_m.left() + (x + 1) * w, grid_m.top() + (y + 1) * h});
+  return bounds;
+}
+
+static FlashGeoRect clampRect(const FlashGeoRect& rect,
+                              const FlashGeoRect& bounds)
+{
+  auto clampCoor = [&bounds](FlashGeoCoor c)
+  {
+    c.lat = std::clamp(c.lat, bounds.top_left.lat,
+                       bounds.bottom_right.lat);
+    c.lon = std::clamp(c.lon, bounds.top_left.lon,
+                       bounds.bottom_right.lon);
+    return c;
+  };
+  return {clampCoor(rect.top_left), clampCoor(rect.bottom_right)};
+}
+
+void FlashMap::appendTilesIn(int tile_idx, const FlashGeoRect& rect,
+                             QVector<int>& ret) const
+{
+  auto& info = tile_infos.at(tile_idx);
+  if (info.first_child < 0)
+  {
+    ret.append(tile_idx);
+    return;
+  }
+  auto clamped = clampRect(rect, info.bounds);
+  for (int i = 0; i < 4; i++)
+    if (tile_infos.at(info.first_child + i).bounds.intersects(clamped))
+      appendTilesIn(info.first_child + i, clamped, ret);
+}
+
+QVector<int> FlashMap::getTilesIn(const FlashGeoRect& rect) const
+{
+  QVector<int> ret;
+  if (tile_side_num == 0)
+    return ret;
+  auto range = getTileRange(rect);
+  for (int y = range.top(); y <= range.bottom(); y++)
+    for (int x = range.left(); x <= range.right(); x++)
+      appendTilesIn(y * tile_side_num + x, rect, ret);
+  return ret;
+}
+
+int FlashMap::getHomeTile(const FlashGeoRect& rect) const
+{
+  auto tile_idxs = getTilesIn(rect);
+  if (!tile_idxs.isEmpty())
+    return tile_idxs.first();
+  auto range    = getTileRange(rect);
+  int  tile_idx = range.top() * tile_side_num + range.left();
+  while (tile_infos.at(tile_idx).first_child >= 0)
+    tile_idx = tile_infos.at(tile_idx).first_child;
+  return tile_idx;
+}
+
+bool FlashMap::loadTilesForEdit(const QVector<int>& tile_idxs)
+{
+  loadVectorTiles(tile_idxs);
+  for (auto tile_idx: tile_idxs)
+  {
+    if (tile_idx < 0 || tile_idx >= tiles.count())
+      return false;
+    auto& tile = tiles[tile_idx];
+    if (tile.status == VectorTile::Null && getTilePos(tile_idx) < 0 &&
+        main.status == VectorTile::Loaded)
+      tile.status = VectorTile::Loaded;
+    if (tile.status != VectorTile::Loaded)
+    {
+      qDebug() << "tile not loaded, edit refused:" << tile_idx;
+      return false;
+    }
+  }
+  return true;
+}
+
+FlashMap::ObjectAddress FlashMap::placeObject(const FlashObject& obj)
+{
+  int  tile_idx  = getHomeTile(obj.frame);
+  auto tile_idxs = getTilesIn(obj.frame);
+  tile_idxs.append(tile_idx);
+  if (!loadTilesForEdit(tile_idxs))
+    return {};
+  auto& tile = tiles[tile_idx];
+  tile.append(obj);
+  tile.last().chunks.clear();
+  tile.clearDrawOrder();
+  tile.dirty = true;
+  ObjectAddress addr{tile_idx + 1, int(tile.count() - 1)};
+  tile_infos[tile_idx].addObject(obj, getClass(obj.class_idx),
+                                 getTimeRange(obj.attributes));
+  if (settings.max_objects_per_tile > 0 &&
+      tile.count() > settings.max_objects_per_tile)
+    overfull_tiles.insert(tile_idx);
+  addCopies(addr, obj);
+  return addr;
+}
+
+void FlashMap::addCopies(const ObjectAddress& home,
+                         const FlashObject&   obj)
+{
+  auto tile_idxs = getTilesIn(obj.frame);
+  if (!loadTilesForEdit(tile_idxs))
+    return;
+  for (auto tile_idx: tile_idxs)
+  {
+    if (tile_idx == home.tile_idx - 1)
+      continue;
+    auto& tile = tiles[tile_idx];
+    tile.home.resize(tile.count());
+    tile.append(obj);
+    tile.last().chunks.clear();
+    tile.home.append(home);
+    tile.clearDrawOrder();
+    tile.dirty = true;
+    tile_infos[tile_idx].addObject(obj, getClass(obj.class_idx),
+                                   getTimeRange(obj.attributes));
+  }
+}
+
+void FlashMap::removeCopies(const ObjectAddress& home,
+                            const FlashGeoRect&  obj_frame)
+{
+  auto tile_idxs = getTilesIn(obj_frame);
+  if (!loadTilesForEdit(tile_idxs))
+    return;
+  for (auto tile_idx: tile_idxs)
+  {
+    auto& tile    = tiles[tile_idx];
+    bool  removed = false;
+    for (int obj_idx = 0; obj_idx < tile.home.count(); obj_idx++)
+      if (tile.home.at(obj_idx) == home)
+      {
+        tile[obj_idx]      = FlashObject();
+        tile.home[obj_idx] = ObjectAddress();
+        removed            = true;
+      }
+    if (!removed)
+      continue;
+    tile.clearDrawOrder();
+    tile.dirty = true;
+    updateTileInfo(tile_idx);
+  }
+}
+
+void FlashMap::dropTombstones()
+{
+  for (auto& tile: tiles)
+    if (tile.status != VectorTile::Loaded)
+      return;
+  QHash<qint64, ObjectAddress> moved;
+  for (int tile_idx = 0; tile_idx < tiles.count(); tile_idx++)
+  {
+    auto& tile    = tiles[tile_idx];
+    int   new_idx = 0;
+    for (int obj_idx = 0; obj_idx < tile.count(); obj_idx++)
+    {
+      if (tile.at(obj_idx).isEmpty())
+        continue;
+      if (new_idx != obj_idx)
+      {
+        tile[new_idx] = tile.at(obj_idx);
+        if (obj_idx < tile.obj_pos.count())
+          tile.obj_pos[new_idx] = tile.obj_pos.at(obj_idx);
+        if (obj_idx < tile.attr_pos.count())
+          tile.attr_pos[new_idx] = tile.attr_pos.at(obj_idx);
+        if (obj_idx < tile.home.count())
+          tile.home[new_idx] = tile.home.at(obj_idx);
+        moved.insert(ObjectAddress{tile_idx + 1, obj_idx}.getKey(),
+                     {tile_idx + 1, new_idx});
+      }
+      new_idx++;
+    }
+    if (new_idx == tile.count())
+      continue;
+    tile.resize(new_idx);
+    tile.obj_pos.resize(std::min(int(tile.obj_pos.count()), new_idx));
+    tile.attr_pos.resize(std::min(int(tile.attr_pos.count()), new_idx));
+    tile.home.resize(std::min(int(tile.home.count()), new_idx));
+    tile.clearDrawOrder();
+    tile.dirty = true;
+  }
+  if (moved.isEmpty())
+    return;
+
+  auto remap = [&moved](ObjectAddress& addr)
+  { addr = moved.value(addr.getKey(), addr); };
+  for (auto& tile: tiles)
+    for (auto& home: tile.home)
+      if (home.isValid())
+        remap(home);
+  for (auto& addr: forwarding)
+    remap(addr);
+  for (auto& addr: id_edits)
+    remap(addr);
+}
+
+void FlashMap::splitTile(int tile_idx)
+{
+  auto bounds      = tile_infos.at(tile_idx).bounds;
+  int  first_child = tiles.count();
+  int  center_lat  = (qint64(bounds.top_left.lat) +
+                      bounds.bottom_right.lat) / 2;
+  int  center_lon  = (qint64(bounds.top_left.lon) +
+                      bounds.bottom_right.lon) / 2;
+  for (int i = 0; i < 4; i++)
+  {
+    TileInfo info;
+    info.bounds = bounds;
+    if (i % 2 == 0)
+      info.bounds.bottom_right.lon = center_lon;
+    else
+      info.bounds.top_left.lon = center_lon;
+    if (i / 2 == 0)
+      info.bounds.bottom_right.lat = center_lat;
+    else
+      info.bounds.top_left.lat = center_lat;
+    tile_infos.append(info);
+    tiles.append(VectorTile());
+    tiles.last().status = VectorTile::Loaded;
+    tiles.last().dirty  = true;
+  }
+
+  VectorTile parent = tiles.at(tile_idx);
+  tiles[tile_idx]   = VectorTile();
+  tiles[tile_idx].status = VectorTile::Loaded;
+  tiles[tile_idx].dirty  = true;
+  TileInfo parent_info;
+  parent_info.pos         = tile_infos.at(tile_idx).pos;
+  parent_info.first_child = first_child;
+  parent_info.bounds      = tile_infos.at(tile_idx).bounds;
+  tile_infos[tile_idx]    = parent_info;
+
+  auto isChild = [first_child](int idx)
+  { return idx >= first_child && idx < first_child + 4; };
+  for (int obj_idx = 0; obj_idx < parent.count(); obj_idx++)
+  {
+    auto obj = parent.at(obj_idx);
+    if (obj.isEmpty())
+      continue;
+    obj.attributes  = parent.getAttributes(obj_idx);
+    auto home       = parent.getHome(obj_idx);
+    auto tile_idxs  = getTilesIn(obj.frame);
+    auto time_range = getTimeRange(obj.attributes);
+    if (tile_idxs.isEmpty())
+      tile_idxs = {getHomeTile(obj.frame)};
+    if (home.isValid())
+    {
+      for (auto idx: tile_idxs)
+        if (isChild(idx))
+        {
+          tiles[idx].home.resize(tiles[idx].count());
+          tiles[idx].append(obj);
+          tiles[idx].home.append(home);
+          tile_infos[idx].addObject(obj, getClass(obj.class_idx),
+                                    time_range);
+        }
+      continue;
+    }
+
+    ObjectAddress old_addr{tile_idx + 1, obj_idx};
+    auto&         new_tile = tiles[tile_idxs.first()];
+    new_tile.append(obj);
+    ObjectAddress new_addr{tile_idxs.first() + 1,
+                           int(new_tile.count() - 1)};
+    tile_infos[tile_idxs.first()].addObject(
+        obj, getClass(obj.class_idx), time_range);
+    forwarding[old_addr.getKey()] = new_addr;
+    for (auto idx: tile_idxs.mid(1))
+    {
+      auto& tile = tiles[idx];
+      if (isChild(idx))
+      {
+        tile.home.resize(tile.count());
+        tile.append(obj);
+        tile.home.append(new_addr);
+        tile_infos[idx].addObject(obj, getClass(obj.class_idx),
+                                  time_range);
+      }
+      else
+        for (auto& h: tile.home)
+          if (h == old_addr)
+          {
+            h          = new_addr;
+            tile.dirty = true;
+          }
+    }
+  }
+
+  for (int i = first_child; i < first_child + 4; i++)
+    if (tiles.at(i).count() > settings.max_objects_per_tile)
+      overfull_tiles.insert(i);
+}
+
+bool FlashMap::needsRebalance() const
+{
+  return !overfull_tiles.isEmpty();
+}
+
+bool FlashMap::rebalanceStep()
+{
+  for (auto& tile: tiles)
+    if (tile.status != VectorTile::Loaded)
+      return false;
+  while (!overfull_tiles.isEmpty())
+  {
+    int tile_idx = *overfull_tiles.begin();
+    overfull_tiles.erase(overfull_tiles.begin());
+    auto size_m  = tile_infos.at(tile_idx).bounds.getSizeMeters();
+    if (tile_infos.at(tile_idx).first_child >= 0 ||
+        tiles.at(tile_idx).count() <= settings.max_objects_per_tile ||
+        std::min(size_m.width(), size_m.height()) < min_tile_size_m * 2)
+      continue;
+    splitTile(tile_idx);
+    break;
+  }
+  return !overfull_tiles.isEmpty();
+}
+
+bool FlashMap::TileInfo::hasClass(int class_idx) const
+{
+  int word_idx = class_idx / 64;
+  return word_idx < class_mask.count() &&
+         (class_mask.at(word_idx) >> (class_idx % 64)) & 1;
+}
+
+void FlashMap::TileInfo::addObject(const FlashObject& obj,
+                                   const FlashClass&  cl,
+                                   const TimeRange&   range)
+{
+  if (obj_count == 0)
+  {
+    frame      = obj.frame;
+    min_mip    = cl.min_mip;
+    max_mip    = cl.max_mip;
+    time_range = range;
+  }
+  else
+  {
+    frame   = frame.united(obj.frame);
+    time_range.unite(range);
+    min_mip = (min_mip == 0 || cl.min_mip == 0)
+                  ? 0
+                  : std::min(min_mip, cl.min_mip);
+    max_mip = (max_mip == 0 || cl.max_mip == 0)
+                  ? 0
+                  : std::max(max_mip, cl.max_mip);
+  }
+  obj_count++;
+  int word_idx = obj.class_idx / 64;
+  if (class_mask.count() <= word_idx)
+    class_mask.resize(word_idx + 1);
+  class_mask[word_idx] |= 1ull << (obj.class_idx % 64);
+}
+
+void FlashMap::TileInfo::save(QByteArray& ba,
+                              int         mask_word_count) const
+{
+  using namespace FlashSerialize;
+  write(ba, pos);
+  write(ba, size);
+  write(ba, hash);
+  write(ba, obj_count);
+  write(ba, first_child);
+  write(ba, bounds.top_left);
+  write(ba, bounds.bottom_right);
+  write(ba, frame.top_left);
+  write(ba, frame.bottom_right);
+  write(ba, min_mip);
+  write(ba, max_mip);
+  write(ba, time_range.from);
+  write(ba, time_range.to);
+  for (int i = 0; i < mask_word_count; i++)
+    write(ba, class_mask.value(i));
+}
+
+void FlashMap::TileInfo::load(FlashSerialize::Cursor& c,
+                              int                     mask_word_count)
+{
+  using namespace FlashSerialize;
+  read(c, pos);
+  read(c, size);
+  read(c, hash);
+  read(c, obj_count);
+  read(c, first_child);
+  read(c, bounds.top_left);
+  read(c, bounds.bottom_right);
+  read(c, frame.top_left);
+  read(c, frame.bottom_right);
+  read(c, min_mip);
+  read(c, max_mip);
+  read(c, time_range.from);
+  read(c, time_range.to);
+  class_mask.clear();
+  if (!c.check(mask_word_count, sizeof(quint64)))
+    return;
+  class_mask.resize(mask_word_count);
+  for (auto& word: class_mask)
+    read(c, word);
+}
+
+FlashMap::TileInfo FlashMap::getTileInfo(const VectorTile& tile) const
+{
+  TileInfo info;
+  for (int obj_idx = 0; obj_idx < tile.count(); obj_idx++)
+  {
+    auto& obj = tile.at(obj_idx);
+    if (!obj.isEmpty())
+      info.addObject(obj, classes.at(obj.class_idx),
+                     getTimeRange(tile.getAttributes(obj_idx)));
+  }
+  return info;
+}
+
+void FlashMap::updateTileInfos()
+{
+  tile_infos.resize(tiles.count());
+  for (int i = 0; i < tiles.count(); i++)
+    updateTileInfo(i);
+}
+
+void FlashMap::updateTileInfo(int tile_idx)
+{
+  auto& old_info   = tile_infos[tile_idx];
+  auto  info       = getTileInfo(tiles.at(tile_idx));
+  info.pos         = old_info.pos;
+  info.size        = old_info.size;
+  info.hash        = old_info.hash;
+  info.first_child = old_info.first_child;
+  info.bounds      = old_info.bounds;
+  old_info         = info;
+}
+
+FlashMap::TileInfo FlashMap::getTileInfo(int tile_idx) const
+{
+  return tile_infos.value(tile_idx);
+}
+
+QVector<int> FlashMap::tilesForRect(const FlashGeoRect& rect,
+                                    double              mip,
+                                    const TimeRange&    range) const
+{
+  QVector<int> ret;
+  for (auto tile_idx: getTilesIn(rect))
+  {
+    auto& info = tile_infos.at(tile_idx);
+    if (info.obj_count == 0 || !info.frame.intersects(rect) ||
+        !info.time_range.overlaps(range))
+      continue;
+    if ((info.min_mip > 0 && mip < info.min_mip) ||
+        (info.max_mip > 0 && mip > info.max_mip))
+      continue;
+    bool has_visible = classes.isEmpty();
+    for (int class_idx = 0;
+         class_idx < classes.count() && !has_visible; class_idx++)
+      has_visible = info.hasClass(class_idx) &&
+                    classes.at(class_idx).isVisible(mip);
+    if (has_visible)
+      ret.append(tile_idx);
+  }
+  return ret;
+}
+
+QVector<FlashMap::ObjectAddress>
+FlashMap::getObjectsIn(const FlashGeoRect& rect,
+                       const TimeRange&    range) const
+{
+  QVector<ObjectAddress> ret;
+  auto isMatch = [&](const VectorTile& tile, int obj_idx)
+  {
+    auto& obj = tile.at(obj_idx);
+    return !obj.isEmpty() && obj.frame.intersects(rect) &&
+           getTimeRange(tile.getAttributes(obj_idx)).overlaps(range);
+  };
+  for (int obj_idx = 0; obj_idx < main.count(); obj_idx++)
+    if (isMatch(main, obj_idx))
+      ret.append({0, obj_idx});
+
+  QVector<int> tile_idxs;
+  for (auto tile_idx: getTilesIn(rect))
+  {
+    auto& info = tile_infos.at(tile_idx);
+    if (tiles.at(tile_idx).status == VectorTile::Loaded &&
+        info.obj_count > 0 && info.frame.intersects(rect) &&
+        info.time_range.overlaps(range))
+      tile_idxs.append(tile_idx);
+  }
+  for (auto tile_idx: tile_idxs)
+  {
+    auto& tile = tiles.at(tile_idx);
+    for (int obj_idx = 0; obj_idx < tile.count(); obj_idx++)
+    {
+      if (!isMatch(tile, obj_idx) ||
+          getCanonicalTileIdx(tile.at(obj_idx).frame, tile_idxs) !=
+              tile_idx)
+        continue;
+      auto home = tile.getHome(obj_idx);
+      ret.append(home.isValid() ? home
+                                : ObjectAddress{tile_idx + 1, obj_idx});
+    }
+  }
+  return ret;
+}
+
+static qint64 parseDateSecs(QByteArray str, bool is_end)
 {
-  this->path = path;
-  settings = v;
+  str = str.trimmed();
+  int len = str.count();
+  if (len == 4)
+    str += "-01-01";
+  else if (len == 7)
+    str += "-01";
+  auto dt = FlashDateTime::fromUtf8(str.constData(), str.count());
+  if (!dt.isValid() || (len != 4 && len != 7 && len < 10))
+    return is_end ? std::numeric_limits<qint64>::max()
+                  : std::numeric_limits<qint64>::min();
+  if (!is_end || len > 10)
+    return dt.getUtcSecs();
+  if (len == 4)
+    dt = FlashDateTime(dt.getYear() + 1, 1, 1, 0, 0, 0, 0);
+  else if (len == 7 && dt.getMonth() == 12)
+    dt = FlashDateTime(dt.getYear() + 1, 1, 1, 0, 0, 0, 0);
+  else if (len == 7)
+    dt = FlashDateTime(dt.getYear(), dt.getMonth() + 1, 1, 0, 0, 0, 0);
+  else
+    dt = dt.addDays(1);
+  return dt.getUtcSecs() - 1;
 }
 
-void FlashMap::clear()
+FlashMap::TimeRange
+FlashMap::getTimeRange(const QMap<QString, QByteArray>& attributes)
 {
-  if (main.status != VectorTile::Loaded)
-    return;
-  if (main.status == VectorTile::Loading)
-    return;
-
-  main.clear();
-  tiles.clear();
-  classes.clear();
-  main.status = VectorTile::Null;
+  TimeRange range;
+  auto      start = attributes.value("start_date");
+  auto      end   = attributes.value("end_date");
+  if (!start.isEmpty())
+    range.from = parseDateSecs(start, false);
+  if (!end.isEmpty())
+    range.to = parseDateSecs(end, true);
+  return range;
 }
 
-qint64 FlashMap::count() const
+bool FlashMap::TimeRange::overlaps(const TimeRange& v) const
 {
-  qint64 total_count = main.count();
-  for (auto t: tiles)
-    total_count += t.count();
-  return total_count;
+  return from <= v.to && v.from <= to;
 }
 
-void FlashMap::save() const
+void FlashMap::TimeRange::unite(const TimeRange& v)
 {
-    save(path);
+  from = std::min(from, v.from);
+  to   = std::max(to, v.to);
 }
 
-void FlashMap::save(const QString& path) const
+int FlashMap::getCanonicalTileIdx(const FlashGeoRect& obj_frame,
+                                  const QVector<int>& tile_idxs) const
 {
-  using namespace FlashSerialize;
+  for (auto tile_idx: getTilesIn(obj_frame))
+    if (tile_idxs.contains(tile_idx))
+      return tile_idx;
+  return -1;
+}
 
-  QFile f(path);
-  if (!f.open(QIODevice::WriteOnly))
+QMap<QString, QByteArray>
+FlashMap::VectorTile::getAttributes(int obj_idx) const
+{
+  auto pos = attr_pos.value(obj_idx, -1);
+  if (pos < 0)
+    return at(obj_idx).attributes;
+  QMap<QString, QByteArray> attributes;
+  FlashSerialize::Cursor    c(data, pos);
+  FlashSerialize::read(c, attributes);
+  if (!c.ok)
   {
-    qDebug() << "write error:" << path;
-    return;
+    qDebug() << "read error: truncated attributes" << obj_idx;
+    return {};
   }
+  return attributes;
+}
 
-  write(&f, QString("flashmap"));
-  write(&f, settings.compression_policy);
-  char has_borders = (borders.count() > 0);
-  write(&f, has_borders);
-
-  if (has_borders)
-  {
-    QByteArray ba;
-    write(ba, borders.count());
-    for (auto border: borders)
-      border.save(ba, border_coor_precision_coef);
-    if (settings.compression_policy == CompressionOn)
-      ba = qCompress(ba, 9);
-    write(&f, ba.count());
-    f.write(ba.data(), ba.count());
-  }
+FlashMap::ObjectAddress FlashMap::VectorTile::getHome(int obj_idx) const
+{
+  return home.value(obj_idx);
+}
 
-  write(&f, settings.main_mip);
-  write(&f, settings.tile_mip);
-  write(&f, classes.count());
-  for (auto cl: classes)
-    cl.save(&f);
+bool FlashMap::VectorTile::hasDrawOrder() const
+{
+  return draw_order_valid;
+}
 
-  write(&f, main.count());
+void FlashMap::VectorTile::clearDrawOrder()
+{
+  draw_order.clear();
+  draw_buckets.clear();
+  draw_order_valid = false;
+}
 
-  QByteArray ba;
-  for (auto& obj: main)
+void FlashMap::VectorTile::buildDrawOrder(
+    const QVector<FlashClass>& classes)
+{
+  QVector<int> class_order(classes.count());
+  std::iota(class_order.begin(), class_order.end(), 0);
+  std::stable_sort(class_order.begin(), class_order.end(),
+                   [&classes](int a, int b)
+                   { return classes.at(a).layer < classes.at(b).layer; });
+
+  QVector<int> class_counts(classes.count());
+  for (auto& obj: *this)
+    if (obj.class_idx >= 0 && obj.class_idx < classes.count())
+      class_counts[obj.class_idx]++;
+
+  QVector<int> class_starts(classes.count());
+  int          start = 0;
+  draw_buckets.clear();
+  for (auto class_idx: class_order)
   {
-    if (!obj.isEmpty())
-      obj.save(classes, ba);
+    int class_count = class_counts.at(class_idx);
+    if (class_count == 0)
+      continue;
+    class_starts[class_idx] = start;
+    draw_buckets.append({class_idx, start, class_count});
+    start += class_count;
   }
-  if (settings.compression_policy == CompressionOn)
-    ba = qCompress(ba, 9);
-  write(&f, ba.count());
-  f.write(ba.data(), ba.count());
-  write(&f, tiles.count());
-  QList<qint64> small_part_pos_list;
 
-  for (int part_idx = 0; auto& tile: tiles)
+  draw_order.resize(count());
+  for (int obj_idx = -1; auto& obj: *this)
   {
-    small_part_pos_list.append(f.pos());
-    if (tile.count() > 0)
-    {
-      write(&f, tile.count());
-      ba.clear();
-      for (auto& obj: tile)
-        obj.save(classes, ba);
-      if (settings.compression_policy == CompressionOn)
-        ba = qCompress(ba, 9);
-      write(&f, ba.count());
-      f.write(ba.data(), ba.count());
-    }
-    else
-      write(&f, 0);
-    part_idx++;
+    obj_idx++;
+    if (obj.class_idx >= 0 && obj.class_idx < classes.count())
+      draw_order[class_starts[obj.class_idx]++] = obj_idx;
   }
-  auto small_idx_start_pos = f.pos();
-  for (auto& pos: small_part_pos_list)
-    write(&f, pos);
-  write(&f, small_idx_start_pos);
+  draw_order.resize(start);
+  draw_order_valid = true;
+}
+
+void FlashMap::updateDrawOrder()
+{
+  if (!main.hasDrawOrder())
+    main.buildDrawOrder(classes);
+  for (auto& tile: tiles)
+    if (!tile.hasDrawOrder())
+      tile.buildDrawOrder(classes);
 }
 
 void FlashMap::loadMainVectorTile(bool load_objects)
@@ -139,31 +1911,30 @@ void FlashMap::loadMainVectorTile(bool load_objects)
   if (main.status != VectorTile::Null)
     return;
 
-  QString format_id;
-  read(&f, format_id);
-
-  read(&f, settings.compression_policy);
+  if (!loadHeader(&f))
+    return;
 
-  char has_borders = false;
-  read(&f, has_borders);
-  if (has_borders)
+  if (borders_section.size > 0)
   {
-    QByteArray ba;
-    int        ba_count = 0;
-    read(&f, ba_count);
-    ba.resize(ba_count);
-    f.read(ba.data(), ba_count);
+    f.seek(borders_section.pos);
+    QByteArray ba = f.read(borders_section.size);
     if (settings.compression_policy == CompressionOn)
       ba = qUncompress(ba);
-    int pos = 0;
-    int borders_count;
-    read(ba, pos, borders_count);
+    Cursor        c(ba);
+    int           borders_count = 0;
+    FlashTopology topology;
+    read(c, borders_count);
+    if (!c.check(borders_count, sizeof(int)))
+      borders_count = 0;
+    topology.load(c);
     borders.resize(borders_count);
 
     for (int idx = -1; auto& border: borders)
     {
       idx++;
-      border.load(ba, pos, border_coor_precision_coef);
+      FlashTopology::ArcRefs refs;
+      read(c, refs);
+      border = topology.getRing(refs);
       if (idx == 0)
         frame = border.getFrame();
       else
@@ -179,17 +1950,27 @@ void FlashMap::loadMainVectorTile(bool load_objects)
     }
   }
 
-  read(&f, settings.main_mip);
-  read(&f, settings.tile_mip);
+  if (frame.isNull())
+  {
+    frame = grid_frame;
+    for (auto& info: tile_infos)
+      if (info.obj_count > 0)
+        frame = frame.isNull() ? info.frame : frame.united(info.frame);
+  }
 
   if (!load_objects)
+  {
+    updateMemoryUsage();
     return;
+  }
 
   qDebug() << "loading main from" << path;
   main.status = VectorTile::Loading;
+  f.seek(classes_section.pos);
   int class_count;
   read(&f, class_count);
   qDebug() << "class_count" << class_count;
+  classes.clear();
   for (int i = 0; i < class_count; i++)
   {
     FlashClass cl;
@@ -197,116 +1978,394 @@ void FlashMap::loadMainVectorTile(bool load_objects)
     classes.append(cl);
   }
 
-  int pos = 0;
-
-  int big_obj_count;
-  read(&f, big_obj_count);
-  main.resize(big_obj_count);
-
-  QByteArray ba;
-  int        ba_count = 0;
-  read(&f, ba_count);
-  ba.resize(ba_count);
-  f.read(ba.data(), ba_count);
-  if (settings.compression_policy == CompressionOn)
-    ba = qUncompress(ba);
-  pos = 0;
-  for (auto& obj: main)
-    obj.load(classes, pos, ba);
-
-  int small_count;
-  read(&f, small_count);
-  tiles.resize(small_count);
+  f.seek(main_section.pos);
+  if (!loadTile(&f, main))
+  {
+    main.status = VectorTile::Null;
+    return;
+  }
+  main.buildDrawOrder(classes);
+  tiles.resize(tile_infos.count());
+  main.status = VectorTile::Loaded;
+  updateMemoryUsage();
 }
 
 void FlashMap::loadAll()
 {
   loadMainVectorTile(true);
   main.status = VectorTile::Loaded;
-  for (int i = 0; i < tiles.count(); i++)
-  {
-    loadVectorTile(i);
-    tiles[i].status = VectorTile::Loaded;
-  }
+  QVector<int> tile_idxs(tiles.count());
+  std::iota(tile_idxs.begin(), tile_idxs.end(), 0);
+  loadVectorTiles(tile_idxs);
+  for (auto& tile: tiles)
+    tile.status = VectorTile::Loaded;
 }
 
 void FlashMap::loadVectorTile(int tile_idx)
+{
+  loadVectorTiles({tile_idx});
+}
+
+void FlashMap::loadVectorTiles(const QVector<int>& tile_idxs)
 {
   if (main.status != VectorTile::Loaded)
     return;
-  if (tiles[tile_idx].status == VectorTile::Loading)
+  auto runs = getReadRuns(tile_idxs);
+  if (runs.isEmpty())
     return;
 
-  qDebug() << "loading tile" << tile_idx << "from" << path;
   QElapsedTimer t;
   t.start();
+  auto loaded     = readRuns(runs);
+  int  tile_count = 0;
+  for (int run_idx = 0; run_idx < runs.count(); run_idx++)
+    for (int i = 0; i < loaded.at(run_idx).count(); i++)
+    {
+      tiles[runs.at(run_idx).tile_idxs.at(i)] = loaded.at(run_idx).at(i);
+      tile_count++;
+    }
+  updateMemoryUsage();
+  qDebug() << "loaded" << tile_count << "tiles in" << runs.count()
+           << "reads," << t.elapsed() << "ms";
+}
+
+QVector<FlashMap::ReadRun>
+FlashMap::getReadRuns(const QVector<int>& _tile_idxs) const
+{
+  QVector<int> tile_idxs;
+  for (auto tile_idx: _tile_idxs)
+    if (tile_idx >= 0 && tile_idx < tiles.count() &&
+        tiles.at(tile_idx).status == VectorTile::Null &&
+        getTilePos(tile_idx) > 0)
+      tile_idxs.append(tile_idx);
+  std::sort(tile_idxs.begin(), tile_idxs.end());
+  tile_idxs.erase(std::unique(tile_idxs.begin(), tile_idxs.end()),
+                  tile_idxs.end());
+  std::sort(tile_idxs.begin(), tile_idxs.end(), [this](int a, int b)
+            { return tile_infos.at(a).pos < tile_infos.at(b).pos; });
+
+  QVector<ReadRun> runs;
+  for (auto tile_idx: tile_idxs)
+  {
+    auto& info = tile_infos.at(tile_idx);
+    if (runs.isEmpty() ||
+        runs.last().pos + runs.last().size != info.pos ||
+        runs.last().size >= max_coalesced_read)
+      runs.append({info.pos, 0, {}});
+    runs.last().size += info.size;
+    runs.last().tile_idxs.append(tile_idx);
+  }
+  return runs;
+}
+
+QVector<FlashMap::VectorTile>
+FlashMap::parseRun(const ReadRun& run, const QByteArray& ba) const
+{
+  QVector<VectorTile> ret;
+  if (ba.count() != run.size)
+  {
+    qDebug() << "read error:" << path << "at" << run.pos;
+    return ret;
+  }
+  QBuffer buffer;
+  buffer.setData(ba);
+  buffer.open(QIODevice::ReadOnly);
+  for (auto tile_idx: run.tile_idxs)
+  {
+    VectorTile tile;
+    buffer.seek(tile_infos.at(tile_idx).pos - run.pos);
+    if (loadTile(&buffer, tile))
+    {
+      tile.buildDrawOrder(classes);
+      tile.status = VectorTile::Loaded;
+    }
+    ret.append(tile);
+  }
+  return ret;
+}
+
+#ifdef FLASHMAP_USE_IO_URING
+bool FlashMap::readRunsUring(const QVector<ReadRun>&       runs,
+                             QVector<QVector<VectorTile>>& ret) const
+{
+  int fd = ::open(QFile::encodeName(path).constData(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  io_uring ring;
+  int      depth = std::min<int>(runs.count(), max_parallel_reads);
+  if (io_uring_queue_init(depth, &ring, 0) < 0)
+  {
+    ::close(fd);
+    return false;
+  }
+
+  QVector<QByteArray> buffers(runs.count());
+  int                 submitted = 0;
+  int                 completed = 0;
+  bool                ok        = true;
+  while (completed < runs.count())
+  {
+    for (; submitted < runs.count() && submitted - completed < depth;
+         submitted++)
+    {
+      auto& run = runs.at(submitted);
+      buffers[submitted].resize(run.size);
+      auto sqe = io_uring_get_sqe(&ring);
+      io_uring_prep_read(sqe, fd, buffers[submitted].data(), run.size,
+                         run.pos);
+      io_uring_sqe_set_data(sqe, (void*)quintptr(submitted));
+    }
+    io_uring_submit(&ring);
+
+    io_uring_cqe* cqe = nullptr;
+    if (io_uring_wait_cqe(&ring, &cqe) < 0)
+    {
+      ok = false;
+      break;
+    }
+    int run_idx = int(quintptr(io_uring_cqe_get_data(cqe)));
+    int res     = cqe->res;
+    io_uring_cqe_seen(&ring, cqe);
+    completed++;
+    auto&  run  = runs.at(run_idx);
+    auto&  ba   = buffers[run_idx];
+    qint64 done = std::max(0, res);
+    while (done < run.size)
+    {
+      auto n = ::pread(fd, ba.data() + done, run.size - done,
+                       run.pos + done);
+      if (n <= 0)
+        break;
+      done += n;
+    }
+    if (done == run.size)
+      ret[run_idx] = parseRun(run, ba);
+    ba.clear();
+  }
+  io_uring_queue_exit(&ring);
+  ::close(fd);
+  return ok;
+}
+#endif
+
+QVector<QVector<FlashMap::VectorTile>>
+FlashMap::readRuns(const QVector<ReadRun>& runs) const
+{
+#ifdef FLASHMAP_USE_IO_URING
+  QVector<QVector<VectorTile>> ret(runs.count());
+  if (readRunsUring(runs, ret))
+  {
+    QVector<int>     failed_idxs;
+    QVector<ReadRun> failed_runs;
+    for (int run_idx = 0; run_idx < runs.count(); run_idx++)
+      if (ret.at(run_idx).isEmpty())
+      {
+        failed_idxs.append(run_idx);
+        failed_runs.append(runs.at(run_idx));
+      }
+    if (failed_runs.isEmpty())
+      return ret;
+    qDebug() << failed_runs.count()
+             << "io_uring reads failed, retrying on thread pool";
+    auto retried = readRunsPooled(failed_runs);
+    for (int i = 0; i < failed_idxs.count(); i++)
+      ret[failed_idxs.at(i)] = retried.at(i);
+    return ret;
+  }
+  qDebug() << "io_uring read failed, falling back to thread pool";
+#endif
+  return readRunsPooled(runs);
+}
+
+QVector<QVector<FlashMap::VectorTile>>
+FlashMap::readRunsPooled(const QVector<ReadRun>& runs) const
+{
+  QThreadPool pool;
+  pool.setMaxThreadCount(
+      std::max(1, std::min<int>(runs.count(), max_parallel_reads)));
+  return QtConcurrent::blockingMapped<QVector<QVector<VectorTile>>>(
+      &pool, runs,
+      [this](const ReadRun& run)
+      {
+        QFile f(path);
+        if (!f.open(QIODevice::ReadOnly) || !f.seek(run.pos))
+          return QVector<VectorTile>();
+        return parseRun(run, f.read(run.size));
+      });
+}
+
+FlashMap::ObjectAddress
+FlashMap::resolve(const ObjectAddress& addr) const
+{
+  auto ret = addr;
+  for (auto it = forwarding.find(ret.getKey()); it != forwarding.end();
+       it      = forwarding.find(ret.getKey()))
+    ret = it.value();
+  return ret;
+}
+
+QVector<FlashMap::IdIndexEntry> FlashMap::buildIdIndex() const
+{
+  QVector<IdIndexEntry> entries;
+  for (int tile_idx = 0; tile_idx <= tiles.count(); tile_idx++)
+  {
+    auto& tile = tile_idx == 0 ? main : tiles.at(tile_idx - 1);
+    for (int obj_idx = 0; obj_idx < tile.count(); obj_idx++)
+      if (tile.at(obj_idx).id != 0 && !tile.getHome(obj_idx).isValid())
+        entries.append({tile.at(obj_idx).id, {tile_idx, obj_idx}});
+  }
+  std::sort(entries.begin(), entries.end(),
+            [](const IdIndexEntry& a, const IdIndexEntry& b)
+            { return a.id < b.id; });
+  return entries;
+}
+
+void FlashMap::loadIdIndex() const
+{
   using namespace FlashSerialize;
+  QMutexLocker locker(&id_index_mutex);
+  if (id_index_loaded)
+    return;
+  id_index_loaded = true;
+  if (id_index_count == 0)
+    return;
   QFile f(path);
   if (!f.open(QIODevice::ReadOnly))
   {
     qDebug() << "read error:" << path;
     return;
   }
-
-  qint64 small_idx_start_pos;
-  f.seek(f.size() - sizeof(qint64));
-  read(&f, small_idx_start_pos);
-
-  int calc_small_part_count =
-      (f.size() - sizeof(qint64) - small_idx_start_pos) /
-      sizeof(qint64);
-  if (calc_small_part_count != tiles.count())
-    return;
-
-  if (tile_idx > tiles.count() - 1)
+  f.seek(id_index_pos);
+  qint64 size = qint64(id_index_count) *
+                (sizeof(qint64) + sizeof(int) * 2);
+  auto   ba   = f.read(size);
+  if (ba.count() != size)
+  {
+    qDebug() << "read error: truncated id index in" << path;
     return;
+  }
+  Cursor c(ba);
+  id_index.resize(id_index_count);
+  for (auto& entry: id_index)
+  {
+    read(c, entry.id);
+    read(c, entry.addr.tile_idx);
+    read(c, entry.addr.obj_idx);
+  }
+}
 
-  f.seek(small_idx_start_pos + tile_idx * sizeof(qint64));
-  qint64 part_pos;
-  read(&f, part_pos);
-  f.seek(part_pos);
+FlashMap::ObjectAddress FlashMap::findObject(qint64 id) const
+{
+  auto edit = id_edits.find(id);
+  if (edit != id_edits.end())
+    return resolve(edit.value());
+  loadIdIndex();
+  auto it = std::lower_bound(id_index.begin(), id_index.end(), id,
+                             [](const IdIndexEntry& entry, qint64 id)
+                             { return entry.id < id; });
+  if (it == id_index.end() || it->id != id)
+    return ObjectAddress();
+  return resolve(it->addr);
+}
 
-  int part_obj_count;
-  read(&f, part_obj_count);
+FreeObject FlashMap::fetchObject(const ObjectAddress& _addr,
+                                 const FlashGeoRect*  visible_rect) const
+{
+  auto addr = resolve(_addr);
+  if (!addr.isValid() || main.status == VectorTile::Null ||
+      addr.tile_idx > tiles.count())
+    return FreeObject();
+  if (addr.tile_idx == 0 ||
+      tiles.at(addr.tile_idx - 1).status != VectorTile::Null)
+    return getObject(addr);
 
-  if (part_obj_count == 0)
-    return;
+  using namespace FlashSerialize;
+  QFile f(path);
+  if (!f.open(QIODevice::ReadOnly))
+  {
+    qDebug() << "read error:" << path;
+    return FreeObject();
+  }
 
-  tiles[tile_idx].resize(part_obj_count);
+  auto part_pos = getTilePos(addr.tile_idx - 1);
+  if (part_pos < 0)
+    return FreeObject();
+  f.seek(part_pos);
 
-  int ba_count = 0;
-  read(&f, ba_count);
-  QByteArray ba;
-  ba.resize(ba_count);
-  f.read(ba.data(), ba_count);
-  if (settings.compression_policy == CompressionOn)
-    ba = qUncompress(ba);
+  int obj_count = 0;
+  read(&f, obj_count);
+  if (addr.obj_idx >= obj_count)
+    return FreeObject();
 
-  tiles[tile_idx].status = VectorTile::Loading;
-  int pos                = 0;
-  for (auto& obj: tiles[tile_idx])
-    obj.load(classes, pos, ba);
+  int block_count = 0;
+  read(&f, block_count);
+  qint64 block_pos =
+      part_pos + sizeof(int) * 2 + block_count * sizeof(int) * 2;
+  int first_obj_idx = 0;
+  for (int i = 0; i < block_count; i++)
+  {
+    int block_obj_count = 0;
+    int block_size      = 0;
+    read(&f, block_obj_count);
+    read(&f, block_size);
+    if (addr.obj_idx < first_obj_idx + block_obj_count)
+    {
+      f.seek(block_pos);
+      QByteArray ba = f.read(block_size);
+      if (settings.compression_policy == CompressionOn)
+        ba = qUncompress(ba);
+      Cursor     table_c(ba);
+      QByteArray topology_ba;
+      read(table_c, topology_ba);
+      auto topology = loadTopology(topology_ba);
+      table_c.pos += (addr.obj_idx - first_obj_idx) * sizeof(int) * 2;
+      int obj_pos  = 0;
+      int attr_pos = 0;
+      read(table_c, obj_pos);
+      read(table_c, attr_pos);
+      if (!table_c.ok)
+        return FreeObject();
+      FlashObject obj;
+      Cursor      c(ba, obj_pos);
+      obj.load(classes, c, &topology, visible_rect);
+      Cursor attr_c(ba, attr_pos);
+      read(attr_c, obj.attributes);
+      if (!c.ok || !attr_c.ok || obj.class_idx < 0)
+        return FreeObject();
+      return {obj, classes.at(obj.class_idx)};
+    }
+    first_obj_idx += block_obj_count;
+    block_pos += block_size;
+  }
+  return FreeObject();
 }
 
-FreeObject FlashMap::getObject(const ObjectAddress& addr) const
+FreeObject FlashMap::getObject(const ObjectAddress& _addr) const
 {
+  auto addr = resolve(_addr);
   if (addr.isValid())
   {
-    if (addr.tile_idx == 0)
-    {
-      auto& obj = main[addr.obj_idx];
-      return {obj, classes.at(obj.class_idx)};
-    }
-    else
-    {
-      auto& obj = tiles[addr.tile_idx - 1][addr.obj_idx];
-      return {obj, classes.at(obj.class_idx)};
-    }
+    auto& tile = addr.tile_idx == 0 ? main : tiles[addr.tile_idx - 1];
+    auto  obj  = tile[addr.obj_idx];
+    if (obj.class_idx < 0)
+      return FreeObject();
+    obj.attributes = tile.getAttributes(addr.obj_idx);
+    return {obj, classes.at(obj.class_idx)};
   }
   else
     return FreeObject();
 }
 
+QMap<QString, QByteArray>
+FlashMap::getAttributes(const ObjectAddress& _addr) const
+{
+  auto addr = resolve(_addr);
+  if (!addr.isValid())
+    return {};
+  auto& tile = addr.tile_idx == 0 ? main : tiles[addr.tile_idx - 1];
+  return tile.getAttributes(addr.obj_idx);
+}
+
 FlashMap::VectorTile FlashMap::getMainTile() const
 {
   return main;
@@ -319,17 +2378,45 @@ QVector<FlashMap::VectorTile> FlashMap::getLocalTiles() const
 
 QVector<FlashObject> FlashMap::getLoadedObjects() const
 {
-  auto objects = main;
+  QVector<FlashObject> objects = main;
+  QSet<qint64>         copied;
+  for (int obj_idx = 0; obj_idx < objects.count(); obj_idx++)
+    objects[obj_idx].attributes = main.getAttributes(obj_idx);
   for (auto& tile: tiles)
-    objects.append(tile);
+    for (int obj_idx = 0; obj_idx < tile.count(); obj_idx++)
+    {
+      if (tile.at(obj_idx).isEmpty())
+        continue;
+      auto home = tile.getHome(obj_idx);
+      if (home.isValid())
+      {
+        if (tiles.at(home.tile_idx - 1).status != VectorTile::Null ||
+            copied.contains(home.getKey()))
+          continue;
+        copied.insert(home.getKey());
+      }
+      objects.append(tile.at(obj_idx));
+      objects.last().attributes = tile.getAttributes(obj_idx);
+    }
   return objects;
 }
 
 void FlashMap::addMap(const FlashMap& map)
 {
-  auto objects = map.getLoadedObjects();
-  for (auto& obj: objects)
-    addObject(obj);
+  for (int tile_idx = 0; tile_idx <= map.tiles.count(); tile_idx++)
+  {
+    auto& tile =
+        tile_idx == 0 ? map.main : map.tiles.at(tile_idx - 1);
+    for (int obj_idx = 0; obj_idx < tile.count(); obj_idx++)
+    {
+      if (tile.at(obj_idx).isEmpty() || tile.getHome(obj_idx).isValid())
+        continue;
+      auto obj       = tile.at(obj_idx);
+      obj.attributes = tile.getAttributes(obj_idx);
+      addObject(obj);
+    }
+  }
+  updateDrawOrder();
 }
 
 void FlashMap::setObject(const ObjectAddress& addr,
@@ -341,6 +2428,8 @@ void FlashMap::setObject(const ObjectAddress& addr,
   {
     classes.append(free_obj.second);
     obj.class_idx = classes.count() - 1;
+    classes_dirty = true;
+    generation++;
   }
   setObject(addr, obj);
 }
@@ -354,19 +2443,42 @@ FlashMap::addObject(const FreeObject& free_obj)
   {
     classes.append(free_obj.second);
     obj.class_idx = classes.count() - 1;
+    classes_dirty = true;
+    generation++;
   }
   return addObject(obj);
 }
 
 void FlashMap::setBorders(const QVector<FlashGeoPolygon>& v)
 {
-  borders = v;
+  borders      = v;
+  layout_dirty = true;
 }
 
 void FlashMap::addObjects(const QVector<FlashObject>& _objects,
                           const QVector<FlashClass>&  _classes)
 {
-  classes = _classes;
+  FlashGeoRect objects_frame;
+  for (int idx = -1; auto& obj: _objects)
+  {
+    idx++;
+    if (idx == 0)
+      objects_frame = obj.frame;
+    else
+      objects_frame = objects_frame.united(obj.frame);
+  }
+  beginObjects(objects_frame, _objects.count(), _classes);
+  addObjectBatch(_objects);
+  endObjects();
+}
+
+void FlashMap::beginObjects(const FlashGeoRect&        objects_frame,
+                            qint64                     object_count,
+                            const QVector<FlashClass>& _classes)
+{
+  classes      = _classes;
+  layout_dirty = true;
+  frame        = objects_frame;
   for (int idx = -1; auto& border: borders)
   {
     idx++;
@@ -375,22 +2487,47 @@ void FlashMap::addObjects(const QVector<FlashObject>& _objects,
     else
       frame = frame.united(border.getFrame());
   }
+  main.status = VectorTile::Loaded;
+  if (settings.main_mip == 0 && settings.tile_mip == 0)
+    return;
+
+  tile_side_num  = std::ceil(1.0 * object_count /
+                             settings.max_objects_per_tile);
+  int tile_count = pow(tile_side_num, 2);
+  tiles.resize(tile_count);
+  tile_infos.resize(tile_count);
+  grid_frame = frame;
+  for (int tile_idx = 0; tile_idx < tile_count; tile_idx++)
+    tile_infos[tile_idx].bounds = getCellBounds(
+        tile_idx % tile_side_num, tile_idx / tile_side_num);
+  for (auto& tile: tiles)
+    tile.status = VectorTile::Loaded;
+}
 
+void FlashMap::addObjectBatch(const QVector<FlashObject>& _objects)
+{
   if (settings.main_mip == 0 && settings.tile_mip == 0)
   {
+    int first_idx = main.count();
     main.append(_objects);
+    for (int i = first_idx; i < main.count(); i++)
+      main[i].chunks.clear();
     return;
   }
 
-  int tile_side_num = std::ceil(1.0 * _objects.count() /
-                                settings.max_objects_per_tile);
-  int tile_count    = pow(tile_side_num, 2);
-  tiles.resize(tile_count);
-  auto map_size_m     = frame.getSizeMeters();
-  auto map_top_left_m = frame.top_left.toMeters();
-  for (auto& src_obj: _objects)
+  QVector<int>     obj_order(_objects.count());
+  QVector<quint64> obj_keys(_objects.count());
+  std::iota(obj_order.begin(), obj_order.end(), 0);
+  for (int obj_idx = 0; obj_idx < _objects.count(); obj_idx++)
+    obj_keys[obj_idx] = getHilbertKey(_objects.at(obj_idx).frame);
+  std::stable_sort(obj_order.begin(), obj_order.end(),
+                   [&obj_keys](int a, int b)
+                   { return obj_keys.at(a) < obj_keys.at(b); });
+
+  for (auto obj_idx: obj_order)
   {
-    FlashObject obj(src_obj);
+    FlashObject obj(_objects.at(obj_idx));
+    obj.chunks.clear();
     if (obj.polygons.isEmpty())
     {
       qDebug() << "No geometry defined for point object"
@@ -405,68 +2542,118 @@ void FlashMap::addObjects(const QVector<FlashObject>& _objects,
     if (cl.max_mip == 0 || cl.max_mip > settings.tile_mip)
       main.append(obj);
     else
-    {
-      auto   obj_top_left_m = obj.frame.top_left.toMeters();
-      double shift_x_m      = obj_top_left_m.x() - map_top_left_m.x();
-      int    part_idx_x =
-          1.0 * shift_x_m / map_size_m.width() * tile_side_num;
-      part_idx_x  = std::clamp(part_idx_x, 0, tile_side_num - 1);
-      int shift_y = obj_top_left_m.y() - map_top_left_m.y();
-      int part_idx_y =
-          1.0 * shift_y / map_size_m.height() * tile_side_num;
-      part_idx_y   = std::clamp(part_idx_y, 0, tile_side_num - 1);
-      int tile_idx = part_idx_y * tile_side_num + part_idx_x;
-      tiles[tile_idx].append(obj);
-    }
+      placeObject(obj);
+  }
+}
+
+void FlashMap::endObjects()
+{
+  if (settings.main_mip == 0 && settings.tile_mip == 0)
+  {
+    updateDrawOrder();
+    return;
   }
+  overfull_tiles.clear();
+  id_index        = buildIdIndex();
+  id_index_loaded = true;
+  id_edits.clear();
+  updateTileInfos();
+  updateDrawOrder();
   qDebug() << "  main tile count" << main.count();
 }
 
 FlashMap::ObjectAddress FlashMap::addObject(const FlashObject& obj)
 {
-  if (frame.isNull())
-    frame = obj.polygons.first().getFrame();
-  else
-    frame = obj.frame.united(obj.polygons.first().getFrame());
-
-  auto map_size_m     = frame.getSizeMeters();
-  auto map_top_left_m = frame.top_left.toMeters();
-
-  int  tile_side_num = sqrt(tiles.count());
-  int  tile_idx      = -1;
-  int  obj_idx       = -1;
-  auto cl            = getClass(obj.class_idx);
-  if (cl.max_mip == 0 || cl.max_mip > settings.tile_mip)
+  if (obj.is_partial)
   {
-    main.append(obj);
-    obj_idx = main.count() - 1;
+    qDebug() << "partially loaded object, add refused";
+    return {};
   }
-  else
+  ObjectAddress addr;
+  auto          cl = getClass(obj.class_idx);
+  if (tiles.isEmpty() || cl.max_mip == 0 ||
+      cl.max_mip > settings.tile_mip)
   {
-    auto   obj_top_left_m = obj.frame.top_left.toMeters();
-    double shift_x_m      = obj_top_left_m.x() - map_top_left_m.x();
-    int    part_idx_x =
-        1.0 * shift_x_m / map_size_m.width() * tile_side_num;
-    int shift_y = obj_top_left_m.y() - map_top_left_m.y();
-    int part_idx_y =
-        1.0 * shift_y / map_size_m.height() * tile_side_num;
-    tile_idx = part_idx_y * tile_side_num + part_idx_x;
-    tiles[tile_idx].append(obj);
-    obj_idx = tiles[tile_idx].count() - 1;
+    main.append(obj);
+    main.last().chunks.clear();
+    main.clearDrawOrder();
+    main.dirty = true;
+    addr       = {0, int(main.count() - 1)};
   }
-  return {tile_idx + 1, obj_idx};
+  else
+    addr = placeObject(obj);
+  if (!addr.isValid())
+    return addr;
+
+  generation++;
+  if (frame.isNull())
+    frame = obj.frame;
+  else
+    frame = frame.united(obj.frame);
+  if (obj.id != 0)
+    id_edits[obj.id] = addr;
+  return addr;
 }
 
-void FlashMap::setObject(const ObjectAddress& addr,
+void FlashMap::setObject(const ObjectAddress& _addr,
                          const FlashObject&   obj)
 {
-  if (addr.isValid())
+  if (!_addr.isValid())
+    return;
+  if (obj.is_partial)
   {
-    if (addr.tile_idx == 0)
-      main[addr.obj_idx] = obj;
-    else
-      tiles[addr.tile_idx - 1][addr.obj_idx] = obj;
+    qDebug() << "partially loaded object, edit refused";
+    return;
+  }
+  auto addr = resolve(_addr);
+  if (addr.tile_idx > 0)
+  {
+    if (!loadTilesForEdit({addr.tile_idx - 1}))
+      return;
+    auto home = tiles.at(addr.tile_idx - 1).getHome(addr.obj_idx);
+    if (home.isValid())
+      addr = home;
+  }
+
+  auto& tile = addr.tile_idx == 0 ? main : tiles[addr.tile_idx - 1];
+  if (addr.tile_idx > 0)
+  {
+    auto tile_idxs = getTilesIn(obj.frame);
+    tile_idxs.append(addr.tile_idx - 1);
+    if (!loadTilesForEdit(tile_idxs))
+      return;
+    if (addr.obj_idx >= 0 && addr.obj_idx < tile.count())
+      tile_idxs = getTilesIn(tile.at(addr.obj_idx).frame);
+    if (!loadTilesForEdit(tile_idxs))
+      return;
+  }
+  if (addr.obj_idx < 0 || addr.obj_idx >= tile.count())
+  {
+    qDebug() << "invalid object address:" << addr.tile_idx
+             << addr.obj_idx;
+    return;
+  }
+  if (tile.at(addr.obj_idx).id != obj.id)
+  {
+    if (tile.at(addr.obj_idx).id != 0)
+      id_edits[tile.at(addr.obj_idx).id] = ObjectAddress();
+    if (obj.id != 0)
+      id_edits[obj.id] = addr;
   }
+  if (addr.tile_idx > 0)
+    removeCopies(addr, tile.at(addr.obj_idx).frame);
+  if (tile[addr.obj_idx].class_idx != obj.class_idx)
+    tile.clearDrawOrder();
+  tile[addr.obj_idx] = obj;
+  tile[addr.obj_idx].chunks.clear();
+  tile.dirty = true;
+  generation++;
+  if (addr.obj_idx < tile.attr_pos.count())
+    tile.attr_pos[addr.obj_idx] = -1;
+  if (addr.tile_idx > 0 && addr.tile_idx <= tile_infos.count())
+    updateTileInfo(addr.tile_idx - 1);
+  if (addr.tile_idx > 0)
+    addCopies(addr, obj);
 }
 
 double FlashMap::getMainMip() const
@@ -479,6 +2666,11 @@ double FlashMap::getTileMip() const
   return settings.tile_mip;
 }
 
+const QVector<FlashClass>& FlashMap::getClasses() const
+{
+  return classes;
+}
+
 const FlashClass& FlashMap::getClass(int idx) const
 {
   return classes.at(idx);
@@ -497,7 +2689,9 @@ QVariant FlashMap::modifyClass(FlashClass new_cl)
   for (auto& cl: classes)
     if (cl.id == new_cl.id)
     {
-      cl = new_cl;
+      cl            = new_cl;
+      classes_dirty = true;
+      updateClassDependents();
       return 0;
     }
   return QString(Q_FUNC_INFO) + ": class id" + new_cl.id +
@@ -506,7 +2700,9 @@ QVariant FlashMap::modifyClass(FlashClass new_cl)
 
 void FlashMap::setClass(int idx, const FlashClass& cl)
 {
-  classes[idx] = cl;
+  classes[idx]  = cl;
+  classes_dirty = true;
+  updateClassDependents();
 }
 
 int FlashMap::getClassCount() const
@@ -516,7 +2712,49 @@ int FlashMap::getClassCount() const
 
 void FlashMap::setClasses(QVector<FlashClass> v)
 {
-  classes = v;
+  classes       = v;
+  classes_dirty = true;
+  updateClassDependents();
+}
+
+void FlashMap::updateClassDependents()
+{
+  generation++;
+  main.clearDrawOrder();
+  for (auto& tile: tiles)
+    tile.clearDrawOrder();
+  for (auto& info: tile_infos)
+  {
+    if (info.obj_count == 0)
+      continue;
+    bool is_first = true;
+    for (int class_idx = 0; class_idx < classes.count(); class_idx++)
+    {
+      int word_idx = class_idx / 64;
+      if (word_idx >= info.class_mask.count() ||
+          !(info.class_mask.at(word_idx) & (1ull << (class_idx % 64))))
+        continue;
+      auto& cl = classes.at(class_idx);
+      if (is_first)
+      {
+        info.min_mip = cl.min_mip;
+        info.max_mip = cl.max_mip;
+        is_first     = false;
+        continue;
+      }
+      info.min_mip = (info.min_mip == 0 || cl.min_mip == 0)
+                         ? 0
+                         : std::min(info.min_mip, cl.min_mip);
+      info.max_mip = (info.max_mip == 0 || cl.max_mip == 0)
+                         ? 0
+                         : std::max(info.max_mip, cl.max_mip);
+    }
+  }
+}
+
+FlashClassImageAtlas FlashMap::getClassImageAtlas() const
+{
+  return FlashClassImageAtlas::build(classes);
 }
 
 FlashGeoRect FlashMap::getFrame() const
@@ -524,6 +2762,16 @@ FlashGeoRect FlashMap::getFrame() const
   return frame;
 }
 
+const QVector<FlashGeoPolygon>& FlashMap::getBorders() const
+{
+  return borders;
+}
+
+const QVector<QPolygonF>& FlashMap::getBordersM() const
+{
+  return borders_m;
+}
+
 FlashMap::VectorTile::Status FlashMap::getMainTileStatus() const
 {
   return main.status;
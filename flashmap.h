@@ -5,9 +5,15 @@
 #include <QPainter>
 #include <QReadWriteLock>
 #include <QMap>
+#include <QHash>
+#include <QSet>
+#include <QMutex>
+#include <QAtomicInteger>
+#include <QSharedPointer>
 #include <QElapsedTimer>
 #include <QVariant>
 #include "flashobject.h"
+#include "flashdatetime.h"
 
 class FlashMap
 {
@@ -21,7 +27,17 @@ public:
   {
     int  tile_idx = -1;
     int  obj_idx  = -1;
-    bool isValid() const;
+    bool   isValid() const;
+    qint64 getKey() const;
+    bool   operator==(const ObjectAddress&) const;
+  };
+  struct TimeRange
+  {
+    qint64 from = std::numeric_limits<qint64>::min();
+    qint64 to   = std::numeric_limits<qint64>::max();
+
+    bool overlaps(const TimeRange&) const;
+    void unite(const TimeRange&);
   };
   struct VectorTile: public QVector<FlashObject>
   {
@@ -31,7 +47,47 @@ public:
       Loading,
       Loaded
     };
-    Status status = Null;
+    struct DrawBucket
+    {
+      int class_idx = -1;
+      int start     = 0;
+      int count     = 0;
+    };
+    Status              status           = Null;
+    bool                dirty            = false;
+    bool                draw_order_valid = false;
+    QByteArray          data;
+    QVector<int>        obj_pos;
+    QVector<int>        attr_pos;
+    QVector<int>        draw_order;
+    QVector<DrawBucket> draw_buckets;
+    QVector<ObjectAddress> home;
+
+    QMap<QString, QByteArray> getAttributes(int obj_idx) const;
+    ObjectAddress             getHome(int obj_idx) const;
+    bool                      hasDrawOrder() const;
+    void buildDrawOrder(const QVector<FlashClass>&);
+    void clearDrawOrder();
+  };
+  struct TileInfo
+  {
+    qint64           pos         = 0;
+    qint64           size        = 0;
+    QByteArray       hash;
+    int              obj_count   = 0;
+    int              first_child = -1;
+    FlashGeoRect     bounds;
+    FlashGeoRect     frame;
+    float            min_mip = 0;
+    float            max_mip = 0;
+    QVector<quint64> class_mask;
+    TimeRange        time_range;
+
+    bool hasClass(int class_idx) const;
+    void addObject(const FlashObject&, const FlashClass&,
+                   const TimeRange&);
+    void save(QByteArray&, int mask_word_count) const;
+    void load(FlashSerialize::Cursor&, int mask_word_count);
   };
   struct Settings
   {
@@ -42,58 +98,236 @@ public:
   };
 
 private:
-  static constexpr int border_coor_precision_coef = 10000;
+  static constexpr int    border_coor_precision_coef = 10000;
+  static constexpr int    format_version             = 14;
+  static constexpr int    block_size_limit           = 64 * 1024;
+  static constexpr double min_tile_size_m            = 10;
+  static constexpr double compaction_ratio           = 2;
+  static constexpr int    hilbert_order              = 16;
+  static constexpr qint64 max_coalesced_read = 4 * 1024 * 1024;
+  static constexpr int    max_parallel_reads = 32;
 
   FlashGeoRect frame;
+  FlashGeoRect grid_frame;
+  int          tile_side_num = 0;
   Settings     settings;
 
+  struct Section
+  {
+    qint64     pos  = 0;
+    qint64     size = 0;
+    QByteArray hash;
+
+    void save(QByteArray&) const;
+    void load(FlashSerialize::Cursor&);
+  };
+  struct IdIndexEntry
+  {
+    qint64        id = 0;
+    ObjectAddress addr;
+  };
+  struct ReadRun
+  {
+    qint64       pos  = 0;
+    qint64       size = 0;
+    QVector<int> tile_idxs;
+  };
+  struct PublishedVersion
+  {
+    QMutex                         mutex;
+    QSharedPointer<const FlashMap> map;
+  };
+  struct PublishedSlot: public QSharedPointer<PublishedVersion>
+  {
+    PublishedSlot()
+        : QSharedPointer(QSharedPointer<PublishedVersion>::create())
+    {
+    }
+    PublishedSlot(const PublishedSlot&): PublishedSlot()
+    {
+    }
+    PublishedSlot& operator=(const PublishedSlot&)
+    {
+      return *this;
+    }
+  };
+
+  struct IndexMutex: public QMutex
+  {
+    IndexMutex()
+    {
+    }
+    IndexMutex(const IndexMutex&)
+    {
+    }
+    IndexMutex& operator=(const IndexMutex&)
+    {
+      return *this;
+    }
+  };
+
+  QHash<qint64, ObjectAddress> forwarding;
+  QSet<int>                    overfull_tiles;
+  QHash<qint64, ObjectAddress> id_edits;
+  qint64                       id_index_pos   = 0;
+  int                          id_index_count = 0;
+  mutable QVector<IdIndexEntry> id_index;
+  mutable bool                  id_index_loaded = false;
+  mutable IndexMutex            id_index_mutex;
+  Section                       classes_section;
+  Section                       main_section;
+  Section                       borders_section;
+  qint64                        base_size       = 0;
+  bool                          classes_dirty   = false;
+  bool                          layout_dirty    = false;
+  int                           generation      = 0;
+  QAtomicInteger<qint64>        memory_usage    = 0;
+  PublishedSlot                 published;
+
+  QByteArray    packTile(const VectorTile&) const;
+  bool          loadTile(QIODevice*, VectorTile&) const;
+  void          updateMemoryUsage();
+  QByteArray    packTopology(const VectorTile&, int start, int end,
+                             QVector<QByteArray>& obj_ba_list) const;
+  FlashTopology loadTopology(const QByteArray&) const;
+  QVector<ReadRun> getReadRuns(const QVector<int>& tile_idxs) const;
+  QVector<VectorTile> parseRun(const ReadRun&, const QByteArray&) const;
+  QVector<QVector<VectorTile>> readRuns(const QVector<ReadRun>&) const;
+  QVector<QVector<VectorTile>>
+  readRunsPooled(const QVector<ReadRun>&) const;
+#ifdef FLASHMAP_USE_IO_URING
+  bool readRunsUring(const QVector<ReadRun>&,
+                     QVector<QVector<VectorTile>>&) const;
+#endif
+  qint64        getTilePos(int tile_idx) const;
+  quint64       getHilbertKey(const FlashGeoRect&) const;
+  QRect         getTileRange(const FlashGeoRect&) const;
+  FlashGeoRect  getCellBounds(int x, int y) const;
+  QVector<int>  getTilesIn(const FlashGeoRect&) const;
+  void          appendTilesIn(int tile_idx, const FlashGeoRect&,
+                              QVector<int>&) const;
+  int           getHomeTile(const FlashGeoRect&) const;
+  bool          loadTilesForEdit(const QVector<int>& tile_idxs);
+  ObjectAddress placeObject(const FlashObject&);
+  void addCopies(const ObjectAddress& home, const FlashObject&);
+  void removeCopies(const ObjectAddress& home, const FlashGeoRect&);
+  void dropTombstones();
+  void splitTile(int tile_idx);
+  QVector<IdIndexEntry> buildIdIndex() const;
+  void                  loadIdIndex() const;
+  Section writeSection(QFile*, const QByteArray&) const;
+  Section writeClasses(QFile*) const;
+  void    writeFooter(QFile*, const QVector<TileInfo>&,
+                      int mask_word_count, const Section& classes,
+                      const Section& main, const Section& borders,
+                      qint64                       base_size,
+                      const QVector<IdIndexEntry>&) const;
+  bool    loadHeader(QFile*);
+  bool    loadFooter(QFile*);
+  void    clearDirty();
+
 protected:
   QVector<FlashClass>      classes;
   QVector<FlashGeoPolygon> borders;
   QVector<QPolygonF>       borders_m;
   VectorTile               main;
   QVector<VectorTile>      tiles;
+  QVector<TileInfo>        tile_infos;
+
+  TileInfo getTileInfo(const VectorTile&) const;
+  void     updateTileInfos();
+  void     updateTileInfo(int tile_idx);
+  void     updateClassDependents();
 
 public:
   FlashMap(const QString& path);
   FlashMap(const QString& path, Settings);
-  void   save() const;
+  void   save();
   void   save(const QString&) const;
+  void   saveChanges();
+  void   compact();
+  bool   isDirty() const;
+  int    getGeneration() const;
+  QByteArray getContentHash() const;
+
+  static bool createPatch(const QString& old_path,
+                          const QString& new_path,
+                          const QString& patch_path);
+  static bool applyPatch(const QString& map_path,
+                         const QString& patch_path);
+  static void benchmarkPatch(const QString& map_path,
+                             double         change_ratio = 0.01);
+  static bool validateSaveChanges(const QString& map_path);
+
+  QSharedPointer<const FlashMap> snapshot() const;
+  QSharedPointer<const FlashMap> pin() const;
+  void                           publish();
   void   loadMainVectorTile(bool load_objects);
   void   loadVectorTile(int tile_idx);
+  void   loadVectorTiles(const QVector<int>& tile_idxs);
   void   loadAll();
   void   clear();
   qint64 count() const;
+  qint64 getMemoryUsage() const;
+  qint64 getLastMemoryUsage() const;
   void   addMap(const FlashMap&);
+  void   updateDrawOrder();
+  bool   needsRebalance() const;
+  bool   rebalanceStep();
 
   QVector<FlashObject> getLoadedObjects() const;
   VectorTile           getMainTile() const;
   QVector<VectorTile>  getLocalTiles() const;
 
-  FreeObject getObject(const ObjectAddress& addr) const;
+  ObjectAddress resolve(const ObjectAddress& addr) const;
+  ObjectAddress findObject(qint64 id) const;
+  FreeObject    getObject(const ObjectAddress& addr) const;
+  FreeObject fetchObject(const ObjectAddress& addr,
+                         const FlashGeoRect*  visible_rect =
+                             nullptr) const;
+  QMap<QString, QByteArray>
+             getAttributes(const ObjectAddress& addr) const;
   void       setObject(const ObjectAddress& addr, const FreeObject&);
   void       setObject(const ObjectAddress& addr, const FlashObject&);
   ObjectAddress addObject(const FlashObject& obj);
   ObjectAddress addObject(const FreeObject& obj);
   void          addObjects(const QVector<FlashObject>&,
                            const QVector<FlashClass>&);
+  void          beginObjects(const FlashGeoRect&        objects_frame,
+                             qint64                     object_count,
+                             const QVector<FlashClass>& classes);
+  void          addObjectBatch(const QVector<FlashObject>&);
+  void          endObjects();
   void          setBorders(const QVector<FlashGeoPolygon>&);
 
   double getMainMip() const;
   double getTileMip() const;
 
+  const QVector<FlashClass>& getClasses() const;
   const FlashClass& getClass(int idx) const;
   FlashClass        getClassById(QString id) const;
   QVariant          modifyClass(FlashClass);
   void              setClass(int idx, const FlashClass&);
   int               getClassCount() const;
   void              setClasses(QVector<FlashClass>);
+  FlashClassImageAtlas getClassImageAtlas() const;
 
-  FlashGeoRect getFrame() const;
+  FlashGeoRect                    getFrame() const;
+  const QVector<FlashGeoPolygon>& getBorders() const;
+  const QVector<QPolygonF>&       getBordersM() const;
 
   VectorTile::Status getMainTileStatus() const;
   VectorTile::Status getTileStatus(int tile_idx) const;
   int                getTileCount() const;
+  TileInfo           getTileInfo(int tile_idx) const;
+  QVector<int>       tilesForRect(const FlashGeoRect&, double mip,
+                                  const TimeRange& = TimeRange()) const;
+  QVector<ObjectAddress> getObjectsIn(const FlashGeoRect&,
+                                      const TimeRange&) const;
+  static TimeRange
+  getTimeRange(const QMap<QString, QByteArray>& attributes);
+  int getCanonicalTileIdx(const FlashGeoRect& obj_frame,
+                          const QVector<int>& tile_idxs) const;
 
   QString path;
 };
@@ -0,0 +1,212 @@
+#include "flashmapcatalog.h"
+#include <QDebug>
+#include <QDir>
+
+quint64 FlashMapCatalog::getCellKey(int cell_x, int cell_y)
+{
+  return (quint64(quint32(cell_x)) << 32) | quint32(cell_y);
+}
+
+int FlashMapCatalog::addMap(const QString& path)
+{
+  FlashMap map(path);
+  map.loadMainVectorTile(false);
+  auto frame = map.getFrame();
+  if (frame.isNull())
+  {
+    qDebug() << "catalog: no frame in" << path;
+    return -1;
+  }
+
+  QMutexLocker locker(&mutex);
+  Entry        entry;
+  entry.path      = path;
+  entry.frame     = frame;
+  entry.borders_m = map.getBordersM();
+  entries.append(entry);
+  int idx = entries.count() - 1;
+
+  for (int cell_y = frame.top_left.lat / cell_size;
+       cell_y <= frame.bottom_right.lat / cell_size; cell_y++)
+    for (int cell_x = frame.top_left.lon / cell_size;
+         cell_x <= frame.bottom_right.lon / cell_size; cell_x++)
+      cells[getCellKey(cell_x, cell_y)].append(idx);
+  return idx;
+}
+
+void FlashMapCatalog::addDir(const QString& dir)
+{
+  auto file_list =
+      QDir(dir).entryInfoList({"*.flashmap"}, QDir::Files, QDir::Name);
+  for (auto& file: file_list)
+    addMap(file.absoluteFilePath());
+}
+
+int FlashMapCatalog::getMapCount() const
+{
+  QMutexLocker locker(&mutex);
+  return entries.count();
+}
+
+FlashMapCatalog::Entry FlashMapCatalog::getEntry(int idx) const
+{
+  QMutexLocker locker(&mutex);
+  return entries.value(idx);
+}
+
+QVector<int>
+FlashMapCatalog::getCandidates(const FlashGeoRect& rect) const
+{
+  QVector<int> ret;
+  QSet<int>    seen;
+  for (int cell_y = rect.top_left.lat / cell_size;
+       cell_y <= rect.bottom_right.lat / cell_size; cell_y++)
+    for (int cell_x = rect.top_left.lon / cell_size;
+         cell_x <= rect.bottom_right.lon / cell_size; cell_x++)
+    {
+      auto it = cells.constFind(getCellKey(cell_x, cell_y));
+      if (it == cells.constEnd())
+        continue;
+      for (auto idx: it.value())
+        if (!seen.contains(idx) && entries.at(idx).frame.intersects(rect))
+        {
+          seen.insert(idx);
+          ret.append(idx);
+        }
+    }
+  std::sort(ret.begin(), ret.end());
+  return ret;
+}
+
+QVector<int> FlashMapCatalog::getMapsAt(const FlashGeoCoor& coor) const
+{
+  QMutexLocker locker(&mutex);
+  QVector<int> ret;
+  auto         coor_m = coor.toMeters();
+  for (auto idx: getCandidates({coor, coor}))
+  {
+    auto& borders_m = entries.at(idx).borders_m;
+    bool  covered   = borders_m.isEmpty();
+    for (auto& border_m: borders_m)
+      if (border_m.containsPoint(coor_m, Qt::OddEvenFill))
+      {
+        covered = true;
+        break;
+      }
+    if (covered)
+      ret.append(idx);
+  }
+  return ret;
+}
+
+QVector<int> FlashMapCatalog::getMapsIn(const FlashGeoRect& rect) const
+{
+  QMutexLocker locker(&mutex);
+  QVector<int> ret;
+  auto         rect_m = QPolygonF(rect.toRectM());
+  for (auto idx: getCandidates(rect))
+  {
+    auto& borders_m = entries.at(idx).borders_m;
+    bool  covered   = borders_m.isEmpty();
+    for (auto& border_m: borders_m)
+      if (border_m.intersects(rect_m))
+      {
+        covered = true;
+        break;
+      }
+    if (covered)
+      ret.append(idx);
+  }
+  return ret;
+}
+
+QSharedPointer<FlashMap> FlashMapCatalog::getMap(int idx)
+{
+  QMutexLocker locker(&mutex);
+  if (idx < 0 || idx >= entries.count())
+    return QSharedPointer<FlashMap>();
+  auto& entry       = entries[idx];
+  entry.last_access = ++access_count;
+  if (!entry.map)
+  {
+    entry.map = QSharedPointer<FlashMap>::create(entry.path);
+    entry.map->loadMainVectorTile(true);
+    enforceMemoryBudget(idx);
+  }
+  return entry.map;
+}
+
+void FlashMapCatalog::loadTiles(int idx, const QVector<int>& tile_idxs)
+{
+  auto map = getMap(idx);
+  if (!map)
+    return;
+  map->loadVectorTiles(tile_idxs);
+  QMutexLocker locker(&mutex);
+  enforceMemoryBudget(idx);
+}
+
+QVector<QSharedPointer<FlashMap>>
+FlashMapCatalog::getMapsFor(const FlashGeoRect& rect)
+{
+  QVector<QSharedPointer<FlashMap>> ret;
+  for (auto idx: getMapsIn(rect))
+    ret.append(getMap(idx));
+  return ret;
+}
+
+void FlashMapCatalog::closeMap(int idx)
+{
+  QMutexLocker locker(&mutex);
+  if (idx >= 0 && idx < entries.count())
+    entries[idx].map.reset();
+}
+
+void FlashMapCatalog::setMemoryBudget(qint64 bytes)
+{
+  QMutexLocker locker(&mutex);
+  memory_budget = bytes;
+  enforceMemoryBudget(-1);
+}
+
+qint64 FlashMapCatalog::getMemoryUsage() const
+{
+  QMutexLocker locker(&mutex);
+  qint64       total_size = FlashClass::getImageCacheUsage();
+  for (auto& entry: entries)
+    if (entry.map)
+      total_size += entry.map->getLastMemoryUsage();
+  return total_size;
+}
+
+void FlashMapCatalog::enforceMemoryBudget(int keep_idx)
+{
+  if (memory_budget <= 0)
+    return;
+  qint64       total_size = FlashClass::getImageCacheUsage();
+  QVector<int> open_idx_list;
+  for (int idx = -1; auto& entry: entries)
+  {
+    idx++;
+    if (!entry.map)
+      continue;
+    total_size += entry.map->getLastMemoryUsage();
+    if (idx != keep_idx)
+      open_idx_list.append(idx);
+  }
+  std::sort(open_idx_list.begin(), open_idx_list.end(),
+            [this](int a, int b)
+            {
+              return entries.at(a).last_access <
+                     entries.at(b).last_access;
+            });
+  for (auto idx: open_idx_list)
+  {
+    if (total_size <= memory_budget)
+      break;
+    auto& entry = entries[idx];
+    total_size -= entry.map->getLastMemoryUsage();
+    qDebug() << "catalog: closing idle map" << entry.path;
+    entry.map.reset();
+  }
+}
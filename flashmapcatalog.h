@@ -0,0 +1,47 @@
+#pragma once
+
+#include "flashmap.h"
+#include <QMutex>
+#include <QSharedPointer>
+
+class FlashMapCatalog
+{
+public:
+  struct Entry
+  {
+    QString                  path;
+    FlashGeoRect             frame;
+    QVector<QPolygonF>       borders_m;
+    QSharedPointer<FlashMap> map;
+    qint64                   last_access = 0;
+  };
+
+private:
+  static constexpr int cell_size = 10000000;
+
+  mutable QMutex               mutex;
+  QVector<Entry>               entries;
+  QHash<quint64, QVector<int>> cells;
+  qint64                       memory_budget = 0;
+  qint64                       access_count  = 0;
+
+  static quint64 getCellKey(int cell_x, int cell_y);
+  QVector<int>   getCandidates(const FlashGeoRect&) const;
+  void           enforceMemoryBudget(int keep_idx);
+
+public:
+  int   addMap(const QString& path);
+  void  addDir(const QString& dir);
+  int   getMapCount() const;
+  Entry getEntry(int idx) const;
+
+  QVector<int> getMapsAt(const FlashGeoCoor&) const;
+  QVector<int> getMapsIn(const FlashGeoRect&) const;
+
+  QSharedPointer<FlashMap>          getMap(int idx);
+  void loadTiles(int idx, const QVector<int>& tile_idxs);
+  QVector<QSharedPointer<FlashMap>> getMapsFor(const FlashGeoRect&);
+  void                              closeMap(int idx);
+  void                              setMemoryBudget(qint64 bytes);
+  qint64                            getMemoryUsage() const;
+};
@@ -0,0 +1,474 @@
+#include "flashnativemap.h"
+#include "flashserialize.h"
+#include <QDebug>
+#include <QElapsedTimer>
+
+static_assert(sizeof(FlashNativeMap::Object) == 56);
+static_assert(sizeof(FlashNativeMap::Attribute) == 16);
+static_assert(sizeof(FlashNativeMap::TileHeader) == 64);
+static_assert(sizeof(FlashNativeMap::TileEntry) == 64);
+static_assert(sizeof(FlashGeoCoor) == 8);
+
+bool FlashNativeMap::Tile::isNull() const
+{
+  return !data;
+}
+
+const FlashNativeMap::TileHeader& FlashNativeMap::Tile::getHeader() const
+{
+  return *(const TileHeader*)data;
+}
+
+int FlashNativeMap::Tile::count() const
+{
+  return data ? getHeader().object_count : 0;
+}
+
+const FlashNativeMap::Object& FlashNativeMap::Tile::at(int obj_idx) const
+{
+  static const Object null_object;
+  if (obj_idx < 0 || obj_idx >= count())
+    return null_object;
+  return ((const Object*)(data + getHeader().objects_pos))[obj_idx];
+}
+
+int FlashNativeMap::Tile::getPolygonIdx(int obj_idx,
+                                        int polygon_idx) const
+{
+  auto& obj = at(obj_idx);
+  if (polygon_idx < 0 || polygon_idx >= obj.polygon_count ||
+      obj.first_polygon < 0)
+    return -1;
+  auto& h       = getHeader();
+  auto  offsets = (const int*)(data + h.polygons_pos);
+  int   idx     = obj.first_polygon + polygon_idx;
+  if (idx >= h.polygon_count || offsets[idx] < 0 ||
+      offsets[idx] > offsets[idx + 1] ||
+      offsets[idx + 1] > h.point_count)
+    return -1;
+  return idx;
+}
+
+bool FlashNativeMap::Tile::isValidAttribute(const Attribute& attr) const
+{
+  auto& h = getHeader();
+  return attr.key_pos >= 0 && attr.key_size >= 0 &&
+         qint64(attr.key_pos) + attr.key_size <= h.pool_size &&
+         attr.value_pos >= 0 && attr.value_size >= 0 &&
+         qint64(attr.value_pos) + attr.value_size <= h.pool_size;
+}
+
+int FlashNativeMap::Tile::getAttributeEnd(const Object& obj) const
+{
+  if (obj.first_attribute < 0 || obj.attribute_count < 0 ||
+      qint64(obj.first_attribute) + obj.attribute_count >
+          getHeader().attribute_count)
+    return obj.first_attribute;
+  return obj.first_attribute + obj.attribute_count;
+}
+
+int FlashNativeMap::Tile::getPointCount(int obj_idx,
+                                        int polygon_idx) const
+{
+  int idx = getPolygonIdx(obj_idx, polygon_idx);
+  if (idx < 0)
+    return 0;
+  auto offsets = (const int*)(data + getHeader().polygons_pos);
+  return offsets[idx + 1] - offsets[idx];
+}
+
+const FlashGeoCoor* FlashNativeMap::Tile::getPoints(int obj_idx,
+                                                    int polygon_idx) const
+{
+  int idx = getPolygonIdx(obj_idx, polygon_idx);
+  if (idx < 0)
+    return nullptr;
+  auto offsets = (const int*)(data + getHeader().polygons_pos);
+  auto points  = (const FlashGeoCoor*)(data + getHeader().points_pos);
+  return points + offsets[idx];
+}
+
+QByteArray FlashNativeMap::Tile::getAttribute(int               obj_idx,
+                                              const QByteArray& key) const
+{
+  if (isNull())
+    return QByteArray();
+  auto& obj   = at(obj_idx);
+  auto  attrs = (const Attribute*)(data + getHeader().attributes_pos);
+  auto  pool  = data + getHeader().pool_pos;
+  for (int i = obj.first_attribute; i < getAttributeEnd(obj); i++)
+  {
+    auto& attr = attrs[i];
+    if (isValidAttribute(attr) && attr.key_size == key.count() &&
+        memcmp(pool + attr.key_pos, key.constData(), key.count()) == 0)
+      return QByteArray::fromRawData(pool + attr.value_pos,
+                                     attr.value_size);
+  }
+  return QByteArray();
+}
+
+QMap<QString, QByteArray>
+FlashNativeMap::Tile::getAttributes(int obj_idx) const
+{
+  QMap<QString, QByteArray> ret;
+  if (isNull())
+    return ret;
+  auto& obj   = at(obj_idx);
+  auto  attrs = (const Attribute*)(data + getHeader().attributes_pos);
+  auto  pool  = data + getHeader().pool_pos;
+  for (int i = obj.first_attribute; i < getAttributeEnd(obj); i++)
+  {
+    auto& attr = attrs[i];
+    if (isValidAttribute(attr))
+      ret.insert(QString::fromUtf8(pool + attr.key_pos, attr.key_size),
+                 QByteArray(pool + attr.value_pos, attr.value_size));
+  }
+  return ret;
+}
+
+FlashObject FlashNativeMap::Tile::toObject(int obj_idx) const
+{
+  auto&       src = at(obj_idx);
+  FlashObject obj;
+  obj.class_idx = src.class_idx;
+  if (obj.class_idx < 0)
+    return obj;
+  obj.id                      = src.id;
+  obj.inner_polygon_start_idx = src.inner_polygon_start_idx;
+  obj.frame                   = src.frame;
+  obj.attributes              = getAttributes(obj_idx);
+
+  int polygon_count = src.polygon_count;
+  if (getPolygonIdx(obj_idx, polygon_count - 1) < 0)
+    polygon_count = 0;
+  obj.polygons.resize(polygon_count);
+  for (int i = 0; i < polygon_count; i++)
+  {
+    auto points = getPoints(obj_idx, i);
+    obj.polygons[i].resize(getPointCount(obj_idx, i));
+    std::copy(points, points + obj.polygons[i].count(),
+              obj.polygons[i].begin());
+  }
+  return obj;
+}
+
+FlashNativeMap::FlashNativeMap(const QString& _path)
+{
+  path = _path;
+}
+
+FlashNativeMap::~FlashNativeMap()
+{
+  close();
+}
+
+bool FlashNativeMap::open()
+{
+  close();
+  QElapsedTimer t;
+  t.start();
+  file.setFileName(path);
+  if (!file.open(QIODevice::ReadOnly))
+  {
+    qDebug() << "read error:" << path;
+    return false;
+  }
+  size = file.size();
+  data = size > 0 ? (const char*)file.map(0, size) : nullptr;
+  if (!data || size < qint64(sizeof(Header)))
+  {
+    qDebug() << "map error:" << path;
+    close();
+    return false;
+  }
+
+  header = (const Header*)data;
+  if (memcmp(header->magic, "flashnat", 8) != 0 ||
+      header->version != format_version ||
+      header->byte_order != byte_order_mark ||
+      header->tile_count < 0 || header->entries_pos < 0 ||
+      header->entries_pos + header->tile_count * sizeof(TileEntry) >
+          quint64(size) ||
+      header->classes_pos < qint64(sizeof(Header)) ||
+      header->classes_pos + qint64(sizeof(int)) > size)
+  {
+    qDebug() << "format error:" << path;
+    close();
+    return false;
+  }
+  entries = (const TileEntry*)(data + header->entries_pos);
+
+  using namespace FlashSerialize;
+  file.seek(header->classes_pos);
+  int class_count = 0;
+  read(&file, class_count);
+  for (int i = 0; i < class_count && !file.atEnd(); i++)
+  {
+    FlashClass cl;
+    cl.load(&file);
+    classes.append(cl);
+  }
+  qDebug() << "native map" << path << "opened in"
+           << t.nsecsElapsed() / 1000 << "us";
+  return true;
+}
+
+void FlashNativeMap::close()
+{
+  if (data)
+    file.unmap((uchar*)data);
+  file.close();
+  data    = nullptr;
+  size    = 0;
+  header  = nullptr;
+  entries = nullptr;
+  classes.clear();
+}
+
+bool FlashNativeMap::isOpen() const
+{
+  return data != nullptr;
+}
+
+void FlashNativeMap::align(QByteArray& ba)
+{
+  ba.append((alignment - ba.count() % alignment) % alignment, 0);
+}
+
+QByteArray FlashNativeMap::packTile(const FlashMap::VectorTile& tile)
+{
+  QVector<Object>       objects(tile.count());
+  QVector<int>          polygons = {0};
+  QVector<FlashGeoCoor> points;
+  QVector<Attribute>    attributes;
+  QByteArray            pool;
+  for (int obj_idx = 0; obj_idx < tile.count(); obj_idx++)
+  {
+    auto& src                   = tile.at(obj_idx);
+    auto& obj                   = objects[obj_idx];
+    obj.id                      = src.id;
+    obj.class_idx               = src.class_idx;
+    obj.inner_polygon_start_idx = src.inner_polygon_start_idx;
+    obj.frame                   = src.frame;
+    obj.home                    = tile.getHome(obj_idx);
+    obj.first_polygon           = polygons.count() - 1;
+    obj.polygon_count           = src.polygons.count();
+    for (auto& polygon: src.polygons)
+    {
+      points.append(polygon);
+      polygons.append(points.count());
+    }
+
+    auto attrs          = tile.getAttributes(obj_idx);
+    obj.first_attribute = attributes.count();
+    obj.attribute_count = attrs.count();
+    for (auto it = attrs.begin(); it != attrs.end(); it++)
+    {
+      auto      key = it.key().toUtf8();
+      Attribute attr;
+      attr.key_pos    = pool.count();
+      attr.key_size   = key.count();
+      pool.append(key);
+      attr.value_pos  = pool.count();
+      attr.value_size = it.value().count();
+      pool.append(it.value());
+      attributes.append(attr);
+    }
+  }
+
+  TileHeader tile_header;
+  tile_header.object_count    = objects.count();
+  tile_header.polygon_count   = polygons.count() - 1;
+  tile_header.point_count     = points.count();
+  tile_header.attribute_count = attributes.count();
+  tile_header.pool_size       = pool.count();
+
+  QByteArray ba(sizeof(TileHeader), 0);
+  auto       append = [&ba](const void* src, qint64 src_size)
+  {
+    align(ba);
+    qint64 pos = ba.count();
+    ba.append((const char*)src, src_size);
+    return pos;
+  };
+  tile_header.objects_pos =
+      append(objects.constData(), objects.count() * sizeof(Object));
+  tile_header.polygons_pos =
+      append(polygons.constData(), polygons.count() * sizeof(int));
+  tile_header.points_pos = append(
+      points.constData(), points.count() * sizeof(FlashGeoCoor));
+  tile_header.attributes_pos = append(
+      attributes.constData(), attributes.count() * sizeof(Attribute));
+  tile_header.pool_pos = append(pool.constData(), pool.count());
+  align(ba);
+  memcpy(ba.data(), &tile_header, sizeof(tile_header));
+  return ba;
+}
+
+bool FlashNativeMap::convert(const QString& src_path,
+                             const QString& dst_path)
+{
+  FlashMap src(src_path);
+  src.loadAll();
+  if (src.getMainTileStatus() != FlashMap::VectorTile::Loaded)
+  {
+    qDebug() << "read error:" << src_path;
+    return false;
+  }
+
+  QFile f(dst_path);
+  if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate))
+  {
+    qDebug() << "write error:" << dst_path;
+    return false;
+  }
+
+  using namespace FlashSerialize;
+  Header file_header;
+  memcpy(file_header.magic, "flashnat", 8);
+  file_header.version    = format_version;
+  file_header.byte_order = byte_order_mark;
+  file_header.tile_count = src.getTileCount();
+  file_header.frame      = src.getFrame();
+  file_header.main_mip   = src.getMainMip();
+  file_header.tile_mip   = src.getTileMip();
+  bool ok = f.write((const char*)&file_header, sizeof(file_header)) ==
+            sizeof(file_header);
+
+  file_header.classes_pos = f.pos();
+  write(&f, src.getClassCount());
+  for (auto& cl: src.getClasses())
+    cl.save(&f);
+
+  auto writeAligned = [&f, &ok](const QByteArray& ba)
+  {
+    QByteArray padding((alignment - f.pos() % alignment) % alignment, 0);
+    ok &= f.write(padding) == padding.count();
+    qint64 pos = f.pos();
+    ok &= f.write(ba) == ba.count();
+    return pos;
+  };
+
+  auto main_ba          = packTile(src.getMainTile());
+  file_header.main_pos  = writeAligned(main_ba);
+  file_header.main_size = main_ba.count();
+
+  auto               tiles = src.getLocalTiles();
+  QVector<TileEntry> tile_entries(tiles.count());
+  for (int i = 0; i < tiles.count(); i++)
+  {
+    auto  ba          = packTile(tiles.at(i));
+    auto  info        = src.getTileInfo(i);
+    auto& entry       = tile_entries[i];
+    entry.pos         = writeAligned(ba);
+    entry.size        = ba.count();
+    entry.obj_count   = info.obj_count;
+    entry.first_child = info.first_child;
+    entry.bounds      = info.bounds;
+    entry.frame       = info.frame;
+    entry.min_mip     = info.min_mip;
+    entry.max_mip     = info.max_mip;
+  }
+  file_header.entries_pos = writeAligned(
+      QByteArray((const char*)tile_entries.constData(),
+                 tile_entries.count() * sizeof(TileEntry)));
+
+  ok &= f.seek(0) &&
+        f.write((const char*)&file_header, sizeof(file_header)) ==
+            sizeof(file_header);
+  ok &= f.flush() && f.error() == QFileDevice::NoError;
+  if (!ok)
+  {
+    qDebug() << "write error:" << dst_path;
+    return false;
+  }
+  qDebug() << "converted" << src_path << "to" << dst_path << ","
+           << f.size() << "bytes";
+  return true;
+}
+
+const QVector<FlashClass>& FlashNativeMap::getClasses() const
+{
+  return classes;
+}
+
+FlashGeoRect FlashNativeMap::getFrame() const
+{
+  return header ? header->frame : FlashGeoRect();
+}
+
+double FlashNativeMap::getMainMip() const
+{
+  return header ? header->main_mip : 0;
+}
+
+double FlashNativeMap::getTileMip() const
+{
+  return header ? header->tile_mip : 0;
+}
+
+int FlashNativeMap::getTileCount() const
+{
+  return header ? header->tile_count : 0;
+}
+
+const FlashNativeMap::TileEntry&
+FlashNativeMap::getTileEntry(int tile_idx) const
+{
+  return entries[tile_idx];
+}
+
+FlashNativeMap::Tile FlashNativeMap::getTileAt(qint64 pos,
+                                               qint64 tile_size) const
+{
+  Tile tile;
+  if (pos < 0 || tile_size < qint64(sizeof(TileHeader)) ||
+      pos + tile_size > size || pos % alignment != 0)
+    return tile;
+  auto& h    = *(const TileHeader*)(data + pos);
+  auto  fits = [tile_size](qint64 section_pos, qint64 item_count,
+                          qint64 item_size)
+  {
+    return section_pos >= qint64(sizeof(TileHeader)) &&
+           section_pos % alignment == 0 && item_count >= 0 &&
+           section_pos + item_count * item_size <= tile_size;
+  };
+  if (!fits(h.objects_pos, h.object_count, sizeof(Object)) ||
+      !fits(h.polygons_pos, h.polygon_count + qint64(1), sizeof(int)) ||
+      !fits(h.points_pos, h.point_count, sizeof(FlashGeoCoor)) ||
+      !fits(h.attributes_pos, h.attribute_count, sizeof(Attribute)) ||
+      !fits(h.pool_pos, h.pool_size, 1))
+  {
+    qDebug() << "format error: tile at" << pos << "in" << path;
+    return tile;
+  }
+  tile.data = data + pos;
+  return tile;
+}
+
+FlashNativeMap::Tile FlashNativeMap::getMainTile() const
+{
+  if (!header)
+    return Tile();
+  return getTileAt(header->main_pos, header->main_size);
+}
+
+FlashNativeMap::Tile FlashNativeMap::getTile(int tile_idx) const
+{
+  if (tile_idx < 0 || tile_idx >= getTileCount())
+    return Tile();
+  return getTileAt(entries[tile_idx].pos, entries[tile_idx].size);
+}
+
+QVector<int> FlashNativeMap::getTilesIn(const FlashGeoRect& rect) const
+{
+  QVector<int> ret;
+  for (int tile_idx = 0; tile_idx < getTileCount(); tile_idx++)
+  {
+    auto& entry = entries[tile_idx];
+    if (entry.first_child < 0 && entry.obj_count > 0 &&
+        entry.frame.intersects(rect))
+      ret.append(tile_idx);
+  }
+  return ret;
+}
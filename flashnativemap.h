@@ -0,0 +1,125 @@
+#pragma once
+
+#include <QFile>
+#include "flashmap.h"
+
+class FlashNativeMap
+{
+public:
+  struct Object
+  {
+    qint64                  id                      = 0;
+    int                     class_idx               = -1;
+    int                     inner_polygon_start_idx = -1;
+    int                     first_polygon           = 0;
+    int                     polygon_count           = 0;
+    int                     first_attribute         = 0;
+    int                     attribute_count         = 0;
+    FlashMap::ObjectAddress home;
+    FlashGeoRect            frame;
+  };
+  struct Attribute
+  {
+    int key_pos    = 0;
+    int key_size   = 0;
+    int value_pos  = 0;
+    int value_size = 0;
+  };
+  struct TileHeader
+  {
+    int    object_count    = 0;
+    int    polygon_count   = 0;
+    int    point_count     = 0;
+    int    attribute_count = 0;
+    int    pool_size       = 0;
+    int    reserved        = 0;
+    qint64 objects_pos     = 0;
+    qint64 polygons_pos    = 0;
+    qint64 points_pos      = 0;
+    qint64 attributes_pos  = 0;
+    qint64 pool_pos        = 0;
+  };
+  struct TileEntry
+  {
+    qint64       pos         = 0;
+    qint64       size        = 0;
+    int          obj_count   = 0;
+    int          first_child = -1;
+    FlashGeoRect bounds;
+    FlashGeoRect frame;
+    float        min_mip = 0;
+    float        max_mip = 0;
+  };
+  struct Tile
+  {
+    const char* data = nullptr;
+
+    bool                isNull() const;
+    const TileHeader&   getHeader() const;
+    int                 count() const;
+    const Object&       at(int obj_idx) const;
+    int                 getPointCount(int obj_idx, int polygon_idx) const;
+    const FlashGeoCoor* getPoints(int obj_idx, int polygon_idx) const;
+    QByteArray getAttribute(int obj_idx, const QByteArray& key) const;
+    QMap<QString, QByteArray> getAttributes(int obj_idx) const;
+    FlashObject               toObject(int obj_idx) const;
+
+  private:
+    int  getPolygonIdx(int obj_idx, int polygon_idx) const;
+    int  getAttributeEnd(const Object&) const;
+    bool isValidAttribute(const Attribute&) const;
+  };
+
+private:
+  static constexpr int format_version  = 1;
+  static constexpr int byte_order_mark = 0x01020304;
+  static constexpr int alignment       = 8;
+
+  struct Header
+  {
+    char         magic[8]    = {};
+    int          version     = 0;
+    int          byte_order  = 0;
+    int          tile_count  = 0;
+    int          reserved    = 0;
+    qint64       classes_pos = 0;
+    qint64       main_pos    = 0;
+    qint64       main_size   = 0;
+    qint64       entries_pos = 0;
+    FlashGeoRect frame;
+    double       main_mip = 0;
+    double       tile_mip = 0;
+  };
+
+  QFile               file;
+  const char*         data    = nullptr;
+  qint64              size    = 0;
+  const Header*       header  = nullptr;
+  const TileEntry*    entries = nullptr;
+  QVector<FlashClass> classes;
+
+  static void       align(QByteArray&);
+  static QByteArray packTile(const FlashMap::VectorTile&);
+  Tile              getTileAt(qint64 pos, qint64 tile_size) const;
+
+public:
+  FlashNativeMap(const QString& path);
+  ~FlashNativeMap();
+  bool open();
+  void close();
+  bool isOpen() const;
+
+  static bool convert(const QString& src_path, const QString& dst_path);
+
+  const QVector<FlashClass>& getClasses() const;
+  FlashGeoRect               getFrame() const;
+  double                     getMainMip() const;
+  double                     getTileMip() const;
+  int                        getTileCount() const;
+  const TileEntry&           getTileEntry(int tile_idx) const;
+  Tile                       getMainTile() const;
+  Tile                       getTile(int tile_idx) const;
+  QVector<int>               getTilesIn(const FlashGeoRect&) const;
+
+  QString path;
+};
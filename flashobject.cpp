@@ -4,22 +4,23 @@
 #include "flashobject.h"
 #include "flashserialize.h"
 
-void FlashObject::load(QVector<FlashClass>& class_list, int& pos,
-                       const QByteArray& ba)
+void FlashObject::load(const QVector<FlashClass>& class_list,
+                       FlashSerialize::Cursor&    c,
+                       const FlashTopology*       topology,
+                       const FlashGeoRect*        visible_rect)
 
 {
   using namespace FlashSerialize;
 
-  read(ba, pos, class_idx);
+  read(c, class_idx);
+  if (class_idx < 0)
+    return;
   auto cl = &class_list[class_idx];
 
-  read(ba, pos, attributes);
-
   if (cl->type == FlashClass::Point)
   {
     FlashGeoCoor p;
-    memcpy((char*)&p, (char*)&ba.data()[pos], sizeof(p));
-    pos += sizeof(p);
+    read(c, p);
     FlashGeoPolygon polygon;
     polygon.append(p);
     polygons.append(polygon);
@@ -28,41 +29,101 @@ void FlashObject::load(QVector<FlashClass>& class_list, int& pos,
     return;
   }
 
+  frame.load(c, cl->coor_precision_coef);
+
   uchar is_multi_polygon;
-  read(ba, pos, is_multi_polygon);
+  read(c, is_multi_polygon);
 
-  if (is_multi_polygon)
+  if (is_multi_polygon == 2)
   {
-    int polygon_count;
-    read(ba, pos, polygon_count);
+    int polygon_count = 0;
+    read(c, polygon_count);
+    if (!c.check(polygon_count, sizeof(int)))
+      return;
+    polygons.resize(polygon_count);
+    for (auto& polygon: polygons)
+    {
+      FlashTopology::ArcRefs refs;
+      read(c, refs);
+      if (topology)
+        polygon = topology->getRing(refs);
+    }
+    read(c, inner_polygon_start_idx);
+    if (!topology)
+      c.ok = false;
+  }
+  else if (is_multi_polygon == 3)
+  {
+    int polygon_count = 0;
+    read(c, polygon_count);
+    if (!c.check(polygon_count, sizeof(int)))
+      return;
     polygons.resize(polygon_count);
-    for (std::size_t i = 0; auto& polygon: polygons)
+    for (int polygon_idx = -1; auto& polygon: polygons)
     {
-      polygon.load(ba, pos, cl->coor_precision_coef);
-      if (i++ == 0)
-        frame = polygon.getFrame();
-      else
-        frame = frame.united(polygon.getFrame());
+      polygon_idx++;
+      int chunk_count = 0;
+      read(c, chunk_count);
+      if (!c.check(chunk_count, sizeof(int)))
+        return;
+      for (int i = 0; i < chunk_count; i++)
+      {
+        Chunk        chunk;
+        FlashGeoCoor first;
+        int          size = 0;
+        chunk.frame.load(c, cl->coor_precision_coef);
+        read(c, first);
+        read(c, size);
+        if (!c.check(size, 1))
+          return;
+        int next_pos      = c.pos + size;
+        chunk.polygon_idx = polygon_idx;
+        chunk.start       = polygon.count();
+        polygon.append(first);
+        if (size > 0 &&
+            (!visible_rect || chunk.frame.intersects(*visible_rect)))
+        {
+          FlashGeoPolygon rest;
+          rest.load(c, cl->coor_precision_coef);
+          polygon.append(rest);
+        }
+        else if (size > 0)
+          is_partial = true;
+        c.pos       = next_pos;
+        chunk.count = polygon.count() - chunk.start;
+        chunks.append(chunk);
+      }
     }
-    read(ba, pos, inner_polygon_start_idx);
+    read(c, inner_polygon_start_idx);
+  }
+  else if (is_multi_polygon)
+  {
+    int polygon_count;
+    read(c, polygon_count);
+    if (!c.check(polygon_count, sizeof(int)))
+      return;
+    polygons.resize(polygon_count);
+    for (auto& polygon: polygons)
+      polygon.load(c, cl->coor_precision_coef);
+    read(c, inner_polygon_start_idx);
   }
   else
   {
     polygons.resize(1);
-    polygons[0].load(ba, pos, cl->coor_precision_coef);
-    frame = polygons[0].getFrame();
+    polygons[0].load(c, cl->coor_precision_coef);
   }
 }
 
-void FlashObject::save(const QVector<FlashClass>& class_list,
-                       QByteArray&                ba) const
-
+void FlashObject::save(
+    const QVector<FlashClass>& class_list, QByteArray& ba,
+    const QVector<FlashTopology::ArcRefs>* arc_refs) const
 {
   using namespace FlashSerialize;
 
-  auto cl = &class_list[class_idx];
   write(ba, class_idx);
-  write(ba, attributes);
+  if (class_idx < 0)
+    return;
+  auto cl = &class_list[class_idx];
 
   if (polygons.isEmpty() || polygons.first().isEmpty())
   {
@@ -77,6 +138,58 @@ void FlashObject::save(const QVector<FlashClass>& class_list,
     return;
   }
 
+  FlashGeoRect obj_frame;
+  for (int i = -1; auto& polygon: polygons)
+  {
+    i++;
+    if (i == 0)
+      obj_frame = polygon.getFrame();
+    else
+      obj_frame = obj_frame.united(polygon.getFrame());
+  }
+  obj_frame.save(ba, cl->coor_precision_coef);
+
+  if (arc_refs)
+  {
+    write(ba, (uchar)2);
+    write(ba, int(polygons.count()));
+    for (auto& refs: *arc_refs)
+      write(ba, refs);
+    write(ba, inner_polygon_start_idx);
+    return;
+  }
+
+  if (isChunked())
+  {
+    write(ba, (uchar)3);
+    write(ba, int(polygons.count()));
+    for (auto& polygon: polygons)
+    {
+      int n           = polygon.count();
+      int chunk_count = (n + chunk_point_count - 1) / chunk_point_count;
+      write(ba, chunk_count);
+      for (int i = 0; i < chunk_count; i++)
+      {
+        int             start = qint64(i) * n / chunk_count;
+        int             end   = qint64(i + 1) * n / chunk_count;
+        FlashGeoPolygon chunk;
+        chunk.append(polygon.mid(start, end - start));
+        chunk.append(polygon.at(end % n));
+        chunk.getFrame().save(ba, cl->coor_precision_coef);
+        write(ba, polygon.at(start));
+
+        FlashGeoPolygon rest;
+        QByteArray      rest_ba;
+        rest.append(polygon.mid(start + 1, end - start - 1));
+        if (!rest.isEmpty())
+          rest.save(rest_ba, cl->coor_precision_coef);
+        write(ba, rest_ba);
+      }
+    }
+    write(ba, inner_polygon_start_idx);
+    return;
+  }
+
   write(ba, (uchar)(polygons.count() > 1));
 
   if (polygons.count() == 1)
@@ -86,7 +199,7 @@ void FlashObject::save(const QVector<FlashClass>& class_list,
   }
   else
   {
-    write(ba, polygons.count());
+    write(ba, int(polygons.count()));
     for (auto& polygon: polygons)
       polygon.save(ba, cl->coor_precision_coef);
     write(ba, inner_polygon_start_idx);
@@ -97,3 +210,11 @@ bool FlashObject::isEmpty() const
 {
   return class_idx < 0 && polygons.isEmpty();
 }
+
+bool FlashObject::isChunked() const
+{
+  for (auto& polygon: polygons)
+    if (polygon.count() > chunk_point_count)
+      return true;
+  return false;
+}
@@ -3,21 +3,38 @@
 #include <QMap>
 #include <QUuid>
 #include "flashclass.h"
+#include "flashtopology.h"
 
 struct FlashObject
 {
+  static constexpr int chunk_point_count = 1024;
+
+  struct Chunk
+  {
+    int          polygon_idx = 0;
+    int          start       = 0;
+    int          count       = 0;
+    FlashGeoRect frame;
+  };
+
   int                       class_idx = -1;
+  qint64                    id        = 0;
   QMap<QString, QByteArray> attributes;
   QVector<FlashGeoPolygon>  polygons;
   int                       inner_polygon_start_idx = -1;
   FlashGeoRect              frame;
+  QVector<Chunk>            chunks;
+  bool                      is_partial = false;
 
 public:
-  void save(const QVector<FlashClass>& class_list,
-            QByteArray&                ba) const;
-  void load(QVector<FlashClass>& class_list, int& pos,
-            const QByteArray& ba);
+  void save(const QVector<FlashClass>& class_list, QByteArray& ba,
+            const QVector<FlashTopology::ArcRefs>* arc_refs =
+                nullptr) const;
+  void load(const QVector<FlashClass>& class_list,
+            FlashSerialize::Cursor&, const FlashTopology* = nullptr,
+            const FlashGeoRect* visible_rect = nullptr);
   bool isEmpty() const;
+  bool isChunked() const;
 };
 
 typedef QPair<FlashObject, FlashClass> FreeObject;
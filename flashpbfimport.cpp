@@ -0,0 +1,908 @@
+#include "flashpbfimport.h"
+#include "flashtagmatcher.h"
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QTemporaryFile>
+#include <QVarLengthArray>
+#include <QtConcurrent>
+#include <QtEndian>
+
+namespace
+{
+constexpr int object_batch_size = 100000;
+
+class PbfReader
+{
+  const uchar* ptr = nullptr;
+  const uchar* end = nullptr;
+
+public:
+  int field     = 0;
+  int wire_type = 0;
+
+  PbfReader() = default;
+  PbfReader(const char* data, qint64 size)
+  {
+    ptr = (const uchar*)data;
+    end = ptr + size;
+  }
+
+  bool atEnd() const
+  {
+    return ptr >= end;
+  }
+
+  bool next()
+  {
+    if (atEnd())
+      return false;
+    auto key  = getVarint();
+    field     = key >> 3;
+    wire_type = key & 7;
+    return true;
+  }
+
+  quint64 getVarint()
+  {
+    quint64 v = 0;
+    for (int shift = 0; ptr < end && shift < 64; shift += 7)
+    {
+      uchar b = *ptr++;
+      v |= quint64(b & 0x7f) << shift;
+      if (!(b & 0x80))
+        break;
+    }
+    return v;
+  }
+
+  qint64 getSVarint()
+  {
+    auto v = getVarint();
+    return qint64(v >> 1) ^ -qint64(v & 1);
+  }
+
+  PbfReader getMessage()
+  {
+    qint64 n = std::min<quint64>(getVarint(), end - ptr);
+    auto   r = PbfReader((const char*)ptr, n);
+    ptr += n;
+    return r;
+  }
+
+  QByteArray getBytes()
+  {
+    auto r = getMessage();
+    return QByteArray((const char*)r.ptr, r.end - r.ptr);
+  }
+
+  void skip()
+  {
+    if (wire_type == 0)
+      getVarint();
+    else if (wire_type == 1)
+      ptr = std::min(ptr + 8, end);
+    else if (wire_type == 2)
+      getMessage();
+    else if (wire_type == 5)
+      ptr = std::min(ptr + 4, end);
+    else
+      ptr = end;
+  }
+};
+
+struct PbfWay
+{
+  qint64                    id        = 0;
+  int                       class_idx = -1;
+  QVector<qint64>           refs;
+  QMap<QString, QByteArray> attributes;
+};
+
+struct PbfRelation
+{
+  qint64                    id        = 0;
+  int                       class_idx = -1;
+  QVector<qint64>           outer_way_ids;
+  QVector<qint64>           inner_way_ids;
+  QMap<QString, QByteArray> attributes;
+};
+
+struct PbfBlock
+{
+  QVector<qint64>       node_ids;
+  QVector<FlashGeoCoor> node_coors;
+  QVector<FlashObject>  point_objects;
+  QVector<PbfWay>       ways;
+  QVector<PbfRelation>  relations;
+  qint64                node_count     = 0;
+  qint64                way_count      = 0;
+  qint64                relation_count = 0;
+};
+
+struct PbfContext
+{
+  enum Pass
+  {
+    Relations,
+    NodesAndWays
+  };
+  Pass                       pass    = Relations;
+  const FlashTagMatcher*     matcher = nullptr;
+  const QVector<FlashClass>* classes = nullptr;
+  QSet<QByteArray>           save_attributes;
+  QSet<qint64>               relation_way_ids;
+};
+
+class NodeLocationStore
+{
+  QTemporaryFile file;
+  uchar*         data     = nullptr;
+  qint64         capacity = 0;
+
+  bool resize(qint64 new_capacity)
+  {
+    if (data)
+      file.unmap(data);
+    data = nullptr;
+    if (!file.resize(new_capacity * sizeof(FlashGeoCoor)))
+      return false;
+    data = file.map(0, new_capacity * sizeof(FlashGeoCoor));
+    if (!data)
+      return false;
+    capacity = new_capacity;
+    return true;
+  }
+
+public:
+  bool open(QString dir)
+  {
+    if (dir.isEmpty())
+      dir = QDir::tempPath();
+    file.setFileTemplate(dir + "/flashnodes-XXXXXX");
+    return file.open() && resize(1ll << 24);
+  }
+
+  void set(qint64 id, const FlashGeoCoor& coor)
+  {
+    if (id < 0)
+      return;
+    if (id >= capacity)
+    {
+      auto new_capacity = capacity;
+      while (id >= new_capacity)
+        new_capacity *= 2;
+      if (!resize(new_capacity))
+      {
+        qDebug() << "error: node store resize failed";
+        return;
+      }
+    }
+    memcpy(data + id * sizeof(FlashGeoCoor), &coor, sizeof(coor));
+  }
+
+  FlashGeoCoor get(qint64 id) const
+  {
+    FlashGeoCoor coor;
+    if (id >= 0 && id < capacity)
+      memcpy(&coor, data + id * sizeof(FlashGeoCoor), sizeof(coor));
+    return coor;
+  }
+};
+
+bool readBlob(QFile* f, QByteArray& type, QByteArray& blob)
+{
+  uchar header_size_ba[4];
+  if (f->read((char*)header_size_ba, 4) != 4)
+    return false;
+  auto      header_size = qFromBigEndian<quint32>(header_size_ba);
+  auto      header      = f->read(header_size);
+  int       data_size   = 0;
+  PbfReader r(header.constData(), header.count());
+  while (r.next())
+  {
+    if (r.field == 1)
+      type = r.getBytes();
+    else if (r.field == 3)
+      data_size = r.getVarint();
+    else
+      r.skip();
+  }
+  blob = f->read(data_size);
+  return blob.count() == data_size;
+}
+
+QByteArray unpackBlob(const QByteArray& blob)
+{
+  QByteArray zlib_data;
+  quint32    raw_size = 0;
+  PbfReader  r(blob.constData(), blob.count());
+  while (r.next())
+  {
+    if (r.field == 1)
+      return r.getBytes();
+    else if (r.field == 2)
+      raw_size = r.getVarint();
+    else if (r.field == 3)
+      zlib_data = r.getBytes();
+    else
+      r.skip();
+  }
+  if (zlib_data.isEmpty())
+  {
+    qDebug() << "error: unsupported pbf blob compression";
+    return QByteArray();
+  }
+  QByteArray ba(4, 0);
+  qToBigEndian<quint32>(raw_size, ba.data());
+  ba.append(zlib_data);
+  return qUncompress(ba);
+}
+
+class BlockDecoder
+{
+  const PbfContext&        ctx;
+  QVector<QByteArray>      strings;
+  QVector<int>             key_ids;
+  QVector<int>             value_ids;
+  QVector<bool>            is_save_attribute;
+  qint64                   granularity = 100;
+  qint64                   lat_offset  = 0;
+  qint64                   lon_offset  = 0;
+  QVarLengthArray<int, 32> tag_keys;
+  QVarLengthArray<int, 32> tag_values;
+
+  FlashGeoCoor getCoor(qint64 lat, qint64 lon) const
+  {
+    return FlashGeoCoor::fromDegs(
+        1E-9 * (lat_offset + granularity * lat),
+        1E-9 * (lon_offset + granularity * lon));
+  }
+
+  void addTag(int key_sid, int value_sid)
+  {
+    if (key_sid < 0 || key_sid >= strings.count() || value_sid < 0 ||
+        value_sid >= strings.count())
+      return;
+    tag_keys.append(key_sid);
+    tag_values.append(value_sid);
+  }
+
+  int classify(FlashClass::Type type) const
+  {
+    QVarLengthArray<int, 32> matcher_keys(tag_keys.count());
+    QVarLengthArray<int, 32> matcher_values(tag_keys.count());
+    for (int i = 0; i < tag_keys.count(); i++)
+    {
+      matcher_keys[i]   = key_ids.at(tag_keys.at(i));
+      matcher_values[i] = value_ids.at(tag_values.at(i));
+    }
+    int class_idx = ctx.matcher->match(
+        matcher_keys.data(), matcher_values.data(), tag_keys.count());
+    if (class_idx < 0)
+      return -1;
+    auto cl_type = ctx.classes->at(class_idx).type;
+    if (type == FlashClass::Line && cl_type == FlashClass::Area)
+      return class_idx;
+    return cl_type == type ? class_idx : -1;
+  }
+
+  QMap<QString, QByteArray> getAttributes() const
+  {
+    QMap<QString, QByteArray> attributes;
+    for (int i = 0; i < tag_keys.count(); i++)
+    {
+      auto& key = strings.at(tag_keys.at(i));
+      if (is_save_attribute.at(tag_keys.at(i)))
+        attributes.insert(QString::fromUtf8(key),
+                          strings.at(tag_values.at(i)));
+    }
+    return attributes;
+  }
+
+  void decodeNode(PbfReader r, PbfBlock& block)
+  {
+    qint64 id  = 0;
+    qint64 lat = 0;
+    qint64 lon = 0;
+    tag_keys.clear();
+    tag_values.clear();
+    QVector<int> keys;
+    QVector<int> values;
+    while (r.next())
+    {
+      if (r.field == 1)
+        id = r.getSVarint();
+      else if (r.field == 2)
+        for (auto packed = r.getMessage(); !packed.atEnd();)
+          keys.append(packed.getVarint());
+      else if (r.field == 3)
+        for (auto packed = r.getMessage(); !packed.atEnd();)
+          values.append(packed.getVarint());
+      else if (r.field == 8)
+        lat = r.getSVarint();
+      else if (r.field == 9)
+        lon = r.getSVarint();
+      else
+        r.skip();
+    }
+    for (int i = 0; i < std::min(keys.count(), values.count()); i++)
+      addTag(keys.at(i), values.at(i));
+    addNode(id, getCoor(lat, lon), block);
+  }
+
+  void decodeDenseNodes(PbfReader r, PbfBlock& block)
+  {
+    QVector<qint64> ids;
+    QVector<qint64> lats;
+    QVector<qint64> lons;
+    QVector<int>    keys_vals;
+    while (r.next())
+    {
+      if (r.field == 1)
+        for (auto packed = r.getMessage(); !packed.atEnd();)
+          ids.append(packed.getSVarint());
+      else if (r.field == 8)
+        for (auto packed = r.getMessage(); !packed.atEnd();)
+          lats.append(packed.getSVarint());
+      else if (r.field == 9)
+        for (auto packed = r.getMessage(); !packed.atEnd();)
+          lons.append(packed.getSVarint());
+      else if (r.field == 10)
+        for (auto packed = r.getMessage(); !packed.atEnd();)
+          keys_vals.append(packed.getVarint());
+      else
+        r.skip();
+    }
+
+    qint64 id  = 0;
+    qint64 lat = 0;
+    qint64 lon = 0;
+    int    kv  = 0;
+    int    n   = std::min({ids.count(), lats.count(), lons.count()});
+    for (int i = 0; i < n; i++)
+    {
+      id += ids.at(i);
+      lat += lats.at(i);
+      lon += lons.at(i);
+      tag_keys.clear();
+      tag_values.clear();
+      while (kv < keys_vals.count() && keys_vals.at(kv) != 0)
+      {
+        if (kv + 1 < keys_vals.count())
+          addTag(keys_vals.at(kv), keys_vals.at(kv + 1));
+        kv += 2;
+      }
+      kv++;
+      addNode(id, getCoor(lat, lon), block);
+    }
+  }
+
+  void addNode(qint64 id, const FlashGeoCoor& coor, PbfBlock& block)
+  {
+    block.node_count++;
+    block.node_ids.append(id);
+    block.node_coors.append(coor);
+    if (tag_keys.isEmpty())
+      return;
+    int class_idx = classify(FlashClass::Point);
+    if (class_idx < 0)
+      return;
+    FlashObject obj;
+    obj.class_idx  = class_idx;
+    obj.attributes = getAttributes();
+    obj.id = flashimport::getOsmObjectId(flashimport::OsmNode, id);
+    FlashGeoPolygon polygon;
+    polygon.append(coor);
+    obj.polygons.append(polygon);
+    obj.frame.top_left     = coor;
+    obj.frame.bottom_right = coor;
+    block.point_objects.append(obj);
+  }
+
+  void decodeWay(PbfReader r, PbfBlock& block)
+  {
+    PbfWay       way;
+    QVector<int> keys;
+    QVector<int> values;
+    while (r.next())
+    {
+      if (r.field == 1)
+        way.id = r.getVarint();
+      else if (r.field == 2)
+        for (auto packed = r.getMessage(); !packed.atEnd();)
+          keys.append(packed.getVarint());
+      else if (r.field == 3)
+        for (auto packed = r.getMessage(); !packed.atEnd();)
+          values.append(packed.getVarint());
+      else if (r.field == 8)
+      {
+        qint64 ref = 0;
+        for (auto packed = r.getMessage(); !packed.atEnd();)
+        {
+          ref += packed.getSVarint();
+          way.refs.append(ref);
+        }
+      }
+      else
+        r.skip();
+    }
+    block.way_count++;
+
+    tag_keys.clear();
+    tag_values.clear();
+    for (int i = 0; i < std::min(keys.count(), values.count()); i++)
+      addTag(keys.at(i), values.at(i));
+    if (!tag_keys.isEmpty())
+      way.class_idx = classify(FlashClass::Line);
+    if (way.class_idx >= 0)
+      way.attributes = getAttributes();
+    if (way.class_idx >= 0 || ctx.relation_way_ids.contains(way.id))
+      block.ways.append(way);
+  }
+
+  void decodeRelation(PbfReader r, PbfBlock& block)
+  {
+    PbfRelation     relation;
+    QVector<int>    keys;
+    QVector<int>    values;
+    QVector<int>    roles;
+    QVector<qint64> member_ids;
+    QVector<int>    member_types;
+    while (r.next())
+    {
+      if (r.field == 1)
+        relation.id = r.getVarint();
+      else if (r.field == 2)
+        for (auto packed = r.getMessage(); !packed.atEnd();)
+          keys.append(packed.getVarint());
+      else if (r.field == 3)
+        for (auto packed = r.getMessage(); !packed.atEnd();)
+          values.append(packed.getVarint());
+      else if (r.field == 8)
+        for (auto packed = r.getMessage(); !packed.atEnd();)
+          roles.append(packed.getVarint());
+      else if (r.field == 9)
+      {
+        qint64 id = 0;
+        for (auto packed = r.getMessage(); !packed.atEnd();)
+        {
+          id += packed.getSVarint();
+          member_ids.append(id);
+        }
+      }
+      else if (r.field == 10)
+        for (auto packed = r.getMessage(); !packed.atEnd();)
+          member_types.append(packed.getVarint());
+      else
+        r.skip();
+    }
+    block.relation_count++;
+
+    tag_keys.clear();
+    tag_values.clear();
+    bool is_multipolygon = false;
+    for (int i = 0; i < std::min(keys.count(), values.count()); i++)
+    {
+      addTag(keys.at(i), values.at(i));
+      if (strings.value(keys.at(i)) == "type")
+      {
+        auto type = strings.value(values.at(i));
+        is_multipolygon =
+            (type == "multipolygon" || type == "boundary");
+      }
+    }
+    if (!is_multipolygon)
+      return;
+    relation.class_idx = classify(FlashClass::Area);
+    if (relation.class_idx < 0)
+      return;
+    relation.attributes = getAttributes();
+
+    int n = std::min({roles.count(), member_ids.count(),
+                      member_types.count()});
+    for (int i = 0; i < n; i++)
+    {
+      if (member_types.at(i) != 1)
+        continue;
+      if (strings.value(roles.at(i)) == "inner")
+        relation.inner_way_ids.append(member_ids.at(i));
+      else
+        relation.outer_way_ids.append(member_ids.at(i));
+    }
+    if (!relation.outer_way_ids.isEmpty())
+      block.relations.append(relation);
+  }
+
+  void decodeGroup(PbfReader r, PbfBlock& block)
+  {
+    while (r.next())
+    {
+      bool relations_pass = ctx.pass == PbfContext::Relations;
+      if (r.field == 1 && !relations_pass)
+        decodeNode(r.getMessage(), block);
+      else if (r.field == 2 && !relations_pass)
+        decodeDenseNodes(r.getMessage(), block);
+      else if (r.field == 3 && !relations_pass)
+        decodeWay(r.getMessage(), block);
+      else if (r.field == 4 && relations_pass)
+        decodeRelation(r.getMessage(), block);
+      else
+        r.skip();
+    }
+  }
+
+public:
+  explicit BlockDecoder(const PbfContext& _ctx): ctx(_ctx)
+  {
+  }
+
+  PbfBlock decode(const QByteArray& blob)
+  {
+    PbfBlock block;
+    auto     data = unpackBlob(blob);
+
+    QVector<PbfReader> groups;
+    PbfReader          r(data.constData(), data.count());
+    while (r.next())
+    {
+      if (r.field == 1)
+      {
+        for (auto st = r.getMessage(); st.next();)
+        {
+          if (st.field == 1)
+            strings.append(st.getBytes());
+          else
+            st.skip();
+        }
+      }
+      else if (r.field == 2)
+        groups.append(r.getMessage());
+      else if (r.field == 17)
+        granularity = r.getVarint();
+      else if (r.field == 19)
+        lat_offset = r.getVarint();
+      else if (r.field == 20)
+        lon_offset = r.getVarint();
+      else
+        r.skip();
+    }
+
+    for (auto& str: strings)
+    {
+      key_ids.append(ctx.matcher->getKeyId(str));
+      value_ids.append(ctx.matcher->getValueId(str));
+      is_save_attribute.append(ctx.save_attributes.contains(str));
+    }
+    for (auto& group: groups)
+      decodeGroup(group, block);
+    return block;
+  }
+};
+
+QVector<QVector<qint64>> assembleRings(QVector<QVector<qint64>> ways)
+{
+  QVector<QVector<qint64>> rings;
+  ways.erase(std::remove_if(ways.begin(), ways.end(),
+                            [](const QVector<qint64>& way)
+                            { return way.count() < 2; }),
+             ways.end());
+  while (!ways.isEmpty())
+  {
+    auto ring = ways.takeFirst();
+    while (ring.first() != ring.last())
+    {
+      bool joined = false;
+      for (int i = 0; i < ways.count(); i++)
+      {
+        auto way = ways.at(i);
+        if (way.last() == ring.last())
+          std::reverse(way.begin(), way.end());
+        if (way.first() == ring.last())
+        {
+          ring.append(way.mid(1));
+          ways.removeAt(i);
+          joined = true;
+          break;
+        }
+      }
+      if (!joined)
+        break;
+    }
+    if (ring.count() >= 4 && ring.first() == ring.last())
+      rings.append(ring);
+  }
+  return rings;
+}
+
+FlashGeoPolygon getPolygon(const QVector<qint64>& refs,
+                           const NodeLocationStore& node_store)
+{
+  FlashGeoPolygon polygon;
+  polygon.reserve(refs.count());
+  for (auto ref: refs)
+  {
+    auto coor = node_store.get(ref);
+    if (coor.isValid())
+      polygon.append(coor);
+  }
+  return polygon;
+}
+
+void updateFrame(FlashObject& obj)
+{
+  for (int i = -1; auto& polygon: obj.polygons)
+  {
+    i++;
+    if (i == 0)
+      obj.frame = polygon.getFrame();
+    else
+      obj.frame = obj.frame.united(polygon.getFrame());
+  }
+}
+
+class ObjectSpill
+{
+  QTemporaryFile file;
+  QByteArray     ba;
+
+public:
+  FlashGeoRect frame;
+  qint64       count = 0;
+
+  bool open(QString dir)
+  {
+    if (dir.isEmpty())
+      dir = QDir::tempPath();
+    file.setFileTemplate(dir + "/flashobjects-XXXXXX");
+    return file.open();
+  }
+
+  void append(const FlashObject& obj)
+  {
+    using namespace FlashSerialize;
+    ba.clear();
+    write(ba, 0);
+    write(ba, obj.class_idx);
+    write(ba, obj.id);
+    write(ba, obj.attributes);
+    write(ba, obj.inner_polygon_start_idx);
+    write(ba, int(obj.polygons.count()));
+    for (auto& polygon: obj.polygons)
+      write(ba, static_cast<const QVector<FlashGeoCoor>&>(polygon));
+    int size = ba.count() - sizeof(int);
+    memcpy(ba.data(), &size, sizeof(size));
+    file.write(ba);
+    frame = count == 0 ? obj.frame : frame.united(obj.frame);
+    count++;
+  }
+
+  bool rewind()
+  {
+    return file.flush() && file.seek(0);
+  }
+
+  bool readBatch(QVector<FlashObject>& objects, int max_count)
+  {
+    using namespace FlashSerialize;
+    objects.clear();
+    while (objects.count() < max_count && !file.atEnd())
+    {
+      int size = 0;
+      read(&file, size);
+      ba = file.read(size);
+      Cursor      c(ba);
+      FlashObject obj;
+      int         polygon_count = 0;
+      read(c, obj.class_idx);
+      read(c, obj.id);
+      read(c, obj.attributes);
+      read(c, obj.inner_polygon_start_idx);
+      read(c, polygon_count);
+      c.check(polygon_count, sizeof(int));
+      for (int i = 0; i < polygon_count && c.ok; i++)
+      {
+        FlashGeoPolygon polygon;
+        read(c, static_cast<QVector<FlashGeoCoor>&>(polygon));
+        obj.polygons.append(polygon);
+      }
+      if (!c.ok || size != ba.count())
+      {
+        qDebug() << "read error: object spill" << file.fileName();
+        return false;
+      }
+      updateFrame(obj);
+      objects.append(obj);
+    }
+    return true;
+  }
+};
+
+template<class Handler>
+bool processBlocks(QString pbf_path, const PbfContext& ctx,
+                   int thread_count, Handler handler)
+{
+  QFile f(pbf_path);
+  if (!f.open(QIODevice::ReadOnly))
+  {
+    qDebug() << "Error opening" << pbf_path;
+    return false;
+  }
+
+  QThreadPool pool;
+  pool.setMaxThreadCount(thread_count);
+  int  batch_size = thread_count * 4;
+  bool at_end     = false;
+  while (!at_end)
+  {
+    QVector<QByteArray> blobs;
+    while (blobs.count() < batch_size)
+    {
+      QByteArray type;
+      QByteArray blob;
+      if (!readBlob(&f, type, blob))
+      {
+        at_end = true;
+        break;
+      }
+      if (type == "OSMData")
+        blobs.append(blob);
+    }
+    auto blocks = QtConcurrent::blockingMapped<QVector<PbfBlock>>(
+        &pool, blobs,
+        [&ctx](const QByteArray& blob)
+        { return BlockDecoder(ctx).decode(blob); });
+    for (auto& block: blocks)
+      handler(block);
+  }
+  return true;
+}
+}
+
+namespace flashimport
+{
+qint64 getOsmObjectId(OsmType type, qint64 osm_id)
+{
+  return (qint64(type + 1) << 56) | osm_id;
+}
+
+PbfImportStats importPbf(QString pbf_path, const FlashClassManager& cm,
+                         FlashMap& map, int thread_count,
+                         QString temp_dir)
+{
+  PbfImportStats  stats;
+  QElapsedTimer   t;
+  FlashTagMatcher matcher(cm.getClasses());
+  t.start();
+
+  PbfContext ctx;
+  ctx.matcher = &matcher;
+  ctx.classes = &cm.getClasses();
+  for (auto& attr: cm.getSaveAttributes())
+    ctx.save_attributes.insert(attr.toUtf8());
+  thread_count = std::max(1, thread_count);
+
+  QVector<PbfRelation> relations;
+  ctx.pass = PbfContext::Relations;
+  if (!processBlocks(pbf_path, ctx, thread_count,
+                     [&](PbfBlock& block)
+                     {
+                       stats.relation_count += block.relation_count;
+                       relations.append(block.relations);
+                     }))
+    return stats;
+  for (auto& relation: relations)
+  {
+    for (auto id: relation.outer_way_ids)
+      ctx.relation_way_ids.insert(id);
+    for (auto id: relation.inner_way_ids)
+      ctx.relation_way_ids.insert(id);
+  }
+
+  NodeLocationStore node_store;
+  if (!node_store.open(temp_dir))
+  {
+    qDebug() << "error: could not create node location store";
+    return stats;
+  }
+
+  ObjectSpill spill;
+  if (!spill.open(temp_dir))
+  {
+    qDebug() << "error: could not create object spill file";
+    return stats;
+  }
+
+  QHash<qint64, QVector<qint64>> relation_way_refs;
+  ctx.pass = PbfContext::NodesAndWays;
+  processBlocks(
+      pbf_path, ctx, thread_count,
+      [&](PbfBlock& block)
+      {
+        stats.node_count += block.node_count;
+        stats.way_count += block.way_count;
+        for (int i = 0; i < block.node_ids.count(); i++)
+          node_store.set(block.node_ids.at(i),
+                         block.node_coors.at(i));
+        for (auto& obj: block.point_objects)
+          spill.append(obj);
+        for (auto& way: block.ways)
+        {
+          if (ctx.relation_way_ids.contains(way.id))
+            relation_way_refs.insert(way.id, way.refs);
+          if (way.class_idx < 0)
+            continue;
+          auto type = cm.getClasses().at(way.class_idx).type;
+          if (type == FlashClass::Area &&
+              (way.refs.count() < 4 ||
+               way.refs.first() != way.refs.last()))
+            continue;
+          FlashObject obj;
+          obj.class_idx  = way.class_idx;
+          obj.id         = getOsmObjectId(OsmWay, way.id);
+          obj.attributes = way.attributes;
+          auto polygon   = getPolygon(way.refs, node_store);
+          if (polygon.count() < 2)
+            continue;
+          obj.polygons.append(polygon);
+          updateFrame(obj);
+          spill.append(obj);
+        }
+      });
+
+  for (auto& relation: relations)
+  {
+    FlashObject obj;
+    obj.class_idx  = relation.class_idx;
+    obj.id         = getOsmObjectId(OsmRelation, relation.id);
+    obj.attributes = relation.attributes;
+    for (int role = 0; role < 2; role++)
+    {
+      auto& way_ids =
+          role == 0 ? relation.outer_way_ids : relation.inner_way_ids;
+      QVector<QVector<qint64>> ways;
+      for (auto id: way_ids)
+        ways.append(relation_way_refs.value(id));
+      if (role == 1)
+        obj.inner_polygon_start_idx = obj.polygons.count();
+      for (auto& ring: assembleRings(ways))
+      {
+        auto polygon = getPolygon(ring, node_store);
+        if (polygon.count() >= 4)
+          obj.polygons.append(polygon);
+      }
+      if (role == 0 && obj.polygons.isEmpty())
+        break;
+    }
+    if (obj.polygons.isEmpty())
+      continue;
+    if (obj.inner_polygon_start_idx >= obj.polygons.count())
+      obj.inner_polygon_start_idx = -1;
+    updateFrame(obj);
+    spill.append(obj);
+  }
+
+  if (!spill.rewind())
+  {
+    qDebug() << "error: could not read object spill file";
+    return stats;
+  }
+  stats.object_count = spill.count;
+  map.beginObjects(spill.frame, spill.count, cm.getClasses());
+  QVector<FlashObject> batch;
+  while (spill.readBatch(batch, object_batch_size) && !batch.isEmpty())
+    map.addObjectBatch(batch);
+  map.endObjects();
+
+  double secs = std::max(1ll, t.nsecsElapsed()) * 1E-9;
+  stats.elements_per_sec =
+      (stats.node_count + stats.way_count + stats.relation_count) /
+      secs;
+  qDebug() << "imported" << pbf_path << ":" << stats.node_count
+           << "nodes," << stats.way_count << "ways,"
+           << stats.relation_count << "relations," << stats.object_count
+           << "objects," << qint64(stats.elements_per_sec)
+           << "elements/sec";
+  return stats;
+}
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "flashmap.h"
+#include "flashclassmanager.h"
+#include <QThread>
+
+namespace flashimport
+{
+struct PbfImportStats
+{
+  qint64 node_count       = 0;
+  qint64 way_count        = 0;
+  qint64 relation_count   = 0;
+  qint64 object_count     = 0;
+  double elements_per_sec = 0;
+};
+
+enum OsmType
+{
+  OsmNode,
+  OsmWay,
+  OsmRelation
+};
+
+qint64 getOsmObjectId(OsmType, qint64 osm_id);
+
+PbfImportStats importPbf(QString pbf_path, const FlashClassManager&,
+                         FlashMap&,
+                         int thread_count = QThread::idealThreadCount(),
+                         QString temp_dir = QString());
+}
@@ -0,0 +1,349 @@
+#include "flashrender.h"
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QPainterPath>
+#include <QtConcurrent>
+
+FlashRender::FlashRender(const FlashMap* _map, Settings _settings)
+{
+  map      = _map;
+  settings = _settings;
+  memory_cache.setMaxCost(settings.memory_cache_kb);
+  updateMapKey();
+}
+
+void FlashRender::updateMapKey()
+{
+  if (map->getGeneration() == map_generation)
+    return;
+  map_generation = map->getGeneration();
+  QCryptographicHash hash(QCryptographicHash::Md5);
+  hash.addData(map->path.toUtf8());
+  hash.addData(map->getContentHash());
+  hash.addData(QByteArray::number(settings.tile_size));
+  hash.addData(QByteArray::number(settings.dpi));
+  map_key        = hash.result().toHex().left(16);
+  use_disk_cache = !map->isDirty();
+  memory_cache.clear();
+  compileStyles();
+}
+
+void FlashRender::compileStyles()
+{
+  double px_per_mm = settings.dpi / 25.4;
+  styles.clear();
+  for (int i = 0; i < map->getClassCount(); i++)
+  {
+    auto& cl = map->getClass(i);
+    Style style;
+    style.image = cl.getImage();
+
+    if (cl.pen.isValid())
+    {
+      style.pen = QPen(cl.pen, std::max(1.0, cl.width_mm * px_per_mm));
+      if (cl.style == FlashClass::Dash)
+        style.pen.setStyle(Qt::DashLine);
+      else if (cl.style == FlashClass::DashDot)
+        style.pen.setStyle(Qt::DashDotLine);
+    }
+    else
+      style.pen = QPen(Qt::NoPen);
+
+    if (cl.type == FlashClass::Point || !cl.brush.isValid() ||
+        cl.type == FlashClass::Line)
+      style.brush = QBrush(Qt::NoBrush);
+    else if (cl.style == FlashClass::Custom && !style.image.isNull())
+      style.brush = QBrush(style.image);
+    else
+    {
+      auto brush_style = Qt::SolidPattern;
+      if (cl.style == FlashClass::BDiag)
+        brush_style = Qt::BDiagPattern;
+      else if (cl.style == FlashClass::FDiag)
+        brush_style = Qt::FDiagPattern;
+      else if (cl.style == FlashClass::Horiz)
+        brush_style = Qt::HorPattern;
+      else if (cl.style == FlashClass::Vert)
+        brush_style = Qt::VerPattern;
+      else if (cl.style == FlashClass::Dots)
+        brush_style = Qt::Dense5Pattern;
+      style.brush = QBrush(cl.brush, brush_style);
+    }
+    if (cl.type == FlashClass::Point && style.image.isNull())
+      style.brush = QBrush(cl.brush.isValid() ? cl.brush : cl.pen);
+
+    style.text_pen = QPen(cl.text);
+    styles.append(style);
+  }
+}
+
+QRectF FlashRender::getTileRectM(const TileKey& key) const
+{
+  double size_m = settings.tile_size * key.mip;
+  return {key.x * size_m, key.y * size_m, size_m, size_m};
+}
+
+QVector<FlashRender::TileKey>
+FlashRender::getTileKeys(const FlashGeoRect& rect, double mip) const
+{
+  QVector<TileKey> ret;
+  if (mip <= 0)
+    return ret;
+  auto   rect_m = rect.toRectM();
+  double size_m = settings.tile_size * mip;
+  for (int y = std::floor(rect_m.top() / size_m);
+       y <= std::floor(rect_m.bottom() / size_m); y++)
+    for (int x = std::floor(rect_m.left() / size_m);
+         x <= std::floor(rect_m.right() / size_m); x++)
+      ret.append({x, y, mip});
+  return ret;
+}
+
+void FlashRender::paintObject(QPainter*                      p,
+                              const FlashMap::ObjectAddress& addr,
+                              const FlashObject&             obj,
+                              const FlashGeoRect&            rect,
+                              const QRectF& rect_m, double mip) const
+{
+  auto& cl      = map->getClass(obj.class_idx);
+  auto& style   = styles.at(obj.class_idx);
+  auto  toPixel = [&](const FlashGeoCoor& coor)
+  {
+    auto m = coor.toMeters();
+    return QPointF((m.x() - rect_m.left()) / mip,
+                   (m.y() - rect_m.top()) / mip);
+  };
+  auto toPolygonPx = [&](int polygon_idx)
+  {
+    auto&     polygon = obj.polygons.at(polygon_idx);
+    QPolygonF polygon_px;
+    polygon_px.reserve(polygon.count());
+    int end = 0;
+    for (auto& chunk: obj.chunks)
+      if (chunk.polygon_idx == polygon_idx && chunk.start >= end &&
+          chunk.count > 0 &&
+          chunk.start + chunk.count <= polygon.count())
+      {
+        for (int i = end; i < chunk.start; i++)
+          polygon_px.append(toPixel(polygon.at(i)));
+        int count = chunk.frame.intersects(rect) ? chunk.count : 1;
+        for (int i = chunk.start; i < chunk.start + count; i++)
+          polygon_px.append(toPixel(polygon.at(i)));
+        end = chunk.start + chunk.count;
+      }
+    for (int i = end; i < polygon.count(); i++)
+      polygon_px.append(toPixel(polygon.at(i)));
+    return polygon_px;
+  };
+
+  if (cl.type == FlashClass::Point)
+  {
+    auto pt = toPixel(obj.polygons.first().first());
+    if (!style.image.isNull())
+      p->drawImage(pt - QPointF(style.image.width() / 2.0,
+                                style.image.height() / 2.0),
+                   style.image);
+    else
+      p->drawEllipse(pt, 3, 3);
+    if (cl.text.isValid() && cl.text.alpha() > 0)
+    {
+      auto name = map->getAttributes(addr).value("name");
+      if (!name.isEmpty())
+      {
+        p->setPen(style.text_pen);
+        p->drawText(pt + QPointF(6, 4), QString::fromUtf8(name));
+        p->setPen(style.pen);
+      }
+    }
+    return;
+  }
+
+  if (cl.type == FlashClass::Line)
+  {
+    for (int i = 0; i < obj.polygons.count(); i++)
+      p->drawPolyline(toPolygonPx(i));
+    return;
+  }
+
+  QPainterPath path;
+  path.setFillRule(Qt::OddEvenFill);
+  for (int i = 0; i < obj.polygons.count(); i++)
+  {
+    path.addPolygon(toPolygonPx(i));
+    path.closeSubpath();
+  }
+  p->drawPath(path);
+}
+
+QImage FlashRender::render(const TileKey& key) const
+{
+  QImage image(settings.tile_size, settings.tile_size,
+               QImage::Format_ARGB32_Premultiplied);
+  image.fill(settings.background);
+
+  auto   rect_m   = getTileRectM(key);
+  double margin_m = margin_px * key.mip;
+  auto   search_m = rect_m.adjusted(-margin_m, -margin_m, margin_m,
+                                    margin_m);
+  FlashGeoRect rect;
+  rect.top_left     = FlashGeoCoor::fromMeters(search_m.topLeft());
+  rect.bottom_right = FlashGeoCoor::fromMeters(search_m.bottomRight());
+
+  auto main  = map->getMainTile();
+  auto tiles = map->getLocalTiles();
+  if (!main.hasDrawOrder())
+    main.buildDrawOrder(map->getClasses());
+  for (int tile_idx = 0; tile_idx < tiles.count(); tile_idx++)
+    if (!tiles.at(tile_idx).hasDrawOrder())
+      tiles[tile_idx].buildDrawOrder(map->getClasses());
+
+  struct Bucket
+  {
+    int                                     layer;
+    int                                     tile_idx;
+    const FlashMap::VectorTile::DrawBucket* bucket;
+  };
+  QVector<Bucket> buckets;
+  auto            rect_tile_idxs = map->tilesForRect(rect, key.mip);
+  QVector<int>    tile_idxs      = {0};
+  for (auto tile_idx: rect_tile_idxs)
+    tile_idxs.append(tile_idx + 1);
+  for (auto tile_idx: tile_idxs)
+  {
+    auto& tile = tile_idx == 0 ? main : tiles.at(tile_idx - 1);
+    for (auto& bucket: tile.draw_buckets)
+    {
+      auto& cl = map->getClass(bucket.class_idx);
+      if (cl.isVisible(key.mip))
+        buckets.append({cl.layer, tile_idx, &bucket});
+    }
+  }
+  std::stable_sort(buckets.begin(), buckets.end(),
+                   [](const Bucket& a, const Bucket& b)
+                   {
+                     if (a.layer != b.layer)
+                       return a.layer < b.layer;
+                     return a.bucket->class_idx < b.bucket->class_idx;
+                   });
+
+  QPainter p(&image);
+  p.setRenderHint(QPainter::Antialiasing);
+  int curr_class_idx = -1;
+  for (auto& bucket: buckets)
+  {
+    auto& tile =
+        bucket.tile_idx == 0 ? main : tiles.at(bucket.tile_idx - 1);
+    for (int i = bucket.bucket->start;
+         i < bucket.bucket->start + bucket.bucket->count; i++)
+    {
+      int   obj_idx = tile.draw_order.at(i);
+      auto& obj     = tile.at(obj_idx);
+      if (obj.polygons.isEmpty() || obj.polygons.first().isEmpty() ||
+          !obj.frame.intersects(rect))
+        continue;
+      if (bucket.tile_idx > 0 &&
+          map->getCanonicalTileIdx(obj.frame, rect_tile_idxs) !=
+              bucket.tile_idx - 1)
+        continue;
+      if (obj.class_idx != curr_class_idx)
+      {
+        curr_class_idx = obj.class_idx;
+        p.setPen(styles.at(curr_class_idx).pen);
+        p.setBrush(styles.at(curr_class_idx).brush);
+      }
+      paintObject(&p, {bucket.tile_idx, obj_idx}, obj, rect, rect_m,
+                  key.mip);
+    }
+  }
+  return image;
+}
+
+QString FlashRender::getCacheKey(const TileKey& key) const
+{
+  return QString("%1/%2/%3_%4")
+      .arg(map_key)
+      .arg(key.mip, 0, 'g', 10)
+      .arg(key.x)
+      .arg(key.y);
+}
+
+QString FlashRender::getCachePath(const TileKey& key) const
+{
+  if (settings.cache_dir.isEmpty() || !use_disk_cache)
+    return QString();
+  return settings.cache_dir + "/" + getCacheKey(key) + ".png";
+}
+
+QImage FlashRender::getTile(const TileKey& key)
+{
+  QString cache_key;
+  QString cache_path;
+  int     generation = 0;
+  {
+    QMutexLocker locker(&cache_mutex);
+    updateMapKey();
+    cache_key  = getCacheKey(key);
+    cache_path = getCachePath(key);
+    generation = map_generation;
+    if (auto image = memory_cache.object(cache_key))
+      return *image;
+  }
+
+  QImage image;
+  if (!cache_path.isEmpty())
+    image.load(cache_path, "PNG");
+  if (image.isNull())
+  {
+    image = render(key);
+    if (!cache_path.isEmpty())
+    {
+      QDir().mkpath(QFileInfo(cache_path).path());
+      image.save(cache_path, "PNG");
+    }
+  }
+
+  QMutexLocker locker(&cache_mutex);
+  if (generation == map_generation)
+    memory_cache.insert(cache_key, new QImage(image),
+                        std::max<qsizetype>(1, image.sizeInBytes() /
+                                                   1024));
+  return image;
+}
+
+QVector<QImage> FlashRender::getTiles(const QVector<TileKey>& keys)
+{
+  QThreadPool pool;
+  pool.setMaxThreadCount(std::max(1, settings.thread_count));
+  {
+    QMutexLocker locker(&cache_mutex);
+    updateMapKey();
+  }
+  return QtConcurrent::blockingMapped<QVector<QImage>>(
+      &pool, keys, [this](const TileKey& key) { return getTile(key); });
+}
+
+void FlashRender::clearMemoryCache()
+{
+  QMutexLocker locker(&cache_mutex);
+  memory_cache.clear();
+}
+
+double FlashRender::benchmark(double mip, int thread_count) const
+{
+  auto keys    = getTileKeys(map->getFrame(), mip);
+  thread_count = std::max(1, thread_count);
+  QThreadPool pool;
+  pool.setMaxThreadCount(thread_count);
+  QElapsedTimer t;
+  t.start();
+  QtConcurrent::blockingMapped<QVector<QImage>>(
+      &pool, keys, [this](const TileKey& key) { return render(key); });
+  double secs                   = std::max(1ll, t.nsecsElapsed()) * 1E-9;
+  double tiles_per_sec_per_core = keys.count() / secs / thread_count;
+  qDebug() << "render:" << keys.count() << "tiles at mip" << mip
+           << "on" << thread_count << "threads,"
+           << tiles_per_sec_per_core << "tiles/sec/core";
+  return tiles_per_sec_per_core;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "flashmap.h"
+#include <QCache>
+#include <QMutex>
+#include <QThread>
+
+class FlashRender
+{
+public:
+  struct Settings
+  {
+    int     tile_size       = 256;
+    double  dpi             = 96;
+    QColor  background      = Qt::white;
+    QString cache_dir;
+    int     memory_cache_kb = 64 * 1024;
+    int     thread_count    = QThread::idealThreadCount();
+  };
+  struct TileKey
+  {
+    int    x   = 0;
+    int    y   = 0;
+    double mip = 0;
+  };
+
+private:
+  static constexpr int margin_px = 16;
+
+  struct Style
+  {
+    QPen   pen;
+    QBrush brush;
+    QPen   text_pen;
+    QImage image;
+  };
+
+  const FlashMap*         map;
+  Settings                settings;
+  QVector<Style>          styles;
+  QCache<QString, QImage> memory_cache;
+  QMutex                  cache_mutex;
+  QString                 map_key;
+  int                     map_generation = -1;
+  bool                    use_disk_cache = false;
+
+  QString getCacheKey(const TileKey&) const;
+  QString getCachePath(const TileKey&) const;
+  void    updateMapKey();
+  void    compileStyles();
+  void    paintObject(QPainter*, const FlashMap::ObjectAddress&,
+                      const FlashObject&, const FlashGeoRect& rect,
+                      const QRectF& rect_m, double mip) const;
+
+public:
+  FlashRender(const FlashMap* map, Settings = Settings());
+
+  QRectF           getTileRectM(const TileKey&) const;
+  QVector<TileKey> getTileKeys(const FlashGeoRect&, double mip) const;
+  QImage           render(const TileKey&) const;
+  QImage           getTile(const TileKey&);
+  QVector<QImage>  getTiles(const QVector<TileKey>&);
+  void             clearMemoryCache();
+  double           benchmark(double mip, int thread_count) const;
+};
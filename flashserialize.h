@@ -1,5 +1,6 @@
 #pragma once
 
+#include <bit>
 #include <type_traits>
 #include <QFile>
 #include <QMap>
@@ -8,15 +9,23 @@
 
 namespace FlashSerialize
 {
+static_assert(std::endian::native == std::endian::little,
+              "flashmap files are written in host byte order");
+
+template<class T>
+constexpr bool is_bulk_copyable = std::is_trivially_copyable_v<T>;
+
 template<class T>
-inline void write(QFile* f, const T& v)
+inline void write(QIODevice* f, const T& v)
 {
+  static_assert(std::is_trivially_copyable_v<T>);
   f->write((char*)&v, sizeof(v));
 }
 
 template<class T>
-inline void read(QFile* f, T& v)
+inline void read(QIODevice* f, T& v)
 {
+  static_assert(std::is_trivially_copyable_v<T>);
   f->read((char*)&v, sizeof(v));
 }
 
@@ -125,16 +134,60 @@ inline void read(QFile* f, QImage& image)
 template<class T>
 inline void write(QByteArray& ba, const T& v)
 {
-  int s = sizeof(v);
-  ba.append((char*)&v, s);
+  static_assert(std::is_trivially_copyable_v<T>);
+  ba.append((const char*)&v, sizeof(v));
+}
+
+struct Cursor
+{
+  const QByteArray& ba;
+  int               pos = 0;
+  bool              ok  = true;
+
+  Cursor(const QByteArray& _ba, int _pos = 0): ba(_ba), pos(_pos)
+  {
+    if (pos < 0 || pos > ba.size())
+      ok = false;
+  }
+  qint64 remaining() const
+  {
+    return ok ? ba.size() - pos : 0;
+  }
+  bool take(void* dst, qint64 n)
+  {
+    if (n < 0 || n > remaining())
+    {
+      ok = false;
+      return false;
+    }
+    memcpy(dst, ba.constData() + pos, n);
+    pos += n;
+    return true;
+  }
+  bool check(qint64 count, qint64 item_size)
+  {
+    if (count < 0 || count * item_size > remaining())
+      ok = false;
+    return ok;
+  }
+};
+
+template<class T>
+inline void read(Cursor& c, T& v)
+{
+  static_assert(std::is_trivially_copyable_v<T>);
+  if (!c.take(&v, sizeof(v)))
+    memset((void*)&v, 0, sizeof(v));
 }
 
 template<class T>
-inline void read(const QByteArray& ba, int& pos, T& v)
+inline void readArray(Cursor& c, T* values, int n)
 {
-  int s = sizeof(v);
-  memcpy(&v, &ba.data()[pos], s);
-  pos += s;
+  if constexpr (is_bulk_copyable<T>)
+    c.take(values, qint64(n) * sizeof(T));
+  else
+    for (int i = 0; i < n; i++)
+      read(c, values[i]);
 }
 
 inline void write(QByteArray& ba, QString str)
@@ -152,64 +205,84 @@ inline void write(QByteArray& ba, QByteArray data)
   ba.append(data, n);
 }
 
-inline void read(const QByteArray& ba, int& pos, QString& str)
+template<class T>
+inline void writeArray(QByteArray& ba, const T* values, int n)
 {
-  int n;
-  read(ba, pos, n);
-  QByteArray ba_str;
-  ba_str.resize(n);
-  memcpy(ba_str.data(), &ba.data()[pos], n);
-  pos += n;
-  str = QString::fromUtf8(ba_str);
+  if constexpr (is_bulk_copyable<T>)
+    ba.append((const char*)values, qsizetype(n) * sizeof(T));
+  else
+    for (int i = 0; i < n; i++)
+      write(ba, values[i]);
 }
 
-inline void read(const QByteArray& ba, int& pos, QByteArray& data)
+inline void read(Cursor& c, QByteArray& data)
 {
-  int n;
-  read(ba, pos, n);
+  int n = 0;
+  read(c, n);
+  data.clear();
+  if (!c.check(n, 1))
+    return;
   data.resize(n);
-  memcpy(data.data(), &ba.data()[pos], n);
-  pos += n;
+  c.take(data.data(), n);
+}
+
+inline void read(Cursor& c, QString& str)
+{
+  QByteArray ba_str;
+  read(c, ba_str);
+  str = QString::fromUtf8(ba_str);
 }
 
 template<class Value>
 inline void write(QByteArray& ba, const QVector<Value>& values)
 {
-  write(ba, values.count());
-  for (auto v: values)
-    write(ba, v);
+  write(ba, int(values.count()));
+  writeArray(ba, values.constData(), values.count());
 }
 
 inline void write(QByteArray& ba, const QStringList& str_list)
 {
-  write(ba, str_list.count());
+  write(ba, int(str_list.count()));
   for (auto v: str_list)
     write(ba, v);
 }
 
 template<class Value>
-inline void read(const QByteArray& ba, int& pos,
-                 QVector<Value>& values)
+inline void read(Cursor& c, QVector<Value>& values)
 {
-  int n;
-  read(ba, pos, n);
-  for (int i = 0; i < n; i++)
+  int n = 0;
+  read(c, n);
+  if (!c.check(n, is_bulk_copyable<Value> ? sizeof(Value) : 1))
+    return;
+  if constexpr (is_bulk_copyable<Value>)
+  {
+    int old_count = values.count();
+    values.resize(old_count + n);
+    readArray(c, values.data() + old_count, n);
+  }
+  else
   {
-    Value v;
-    read(ba, pos, v);
-    values.append(v);
+    values.reserve(values.count() + n);
+    for (int i = 0; i < n && c.ok; i++)
+    {
+      Value v;
+      read(c, v);
+      values.append(v);
+    }
   }
 }
 
-inline void read(const QByteArray& ba, int& pos,
-                 QStringList& str_list)
+inline void read(Cursor& c, QStringList& str_list)
 {
-  int n;
-  read(ba, pos, n);
-  for (int i = 0; i < n; i++)
+  int n = 0;
+  read(c, n);
+  if (!c.check(n, sizeof(int)))
+    return;
+  str_list.reserve(str_list.count() + n);
+  for (int i = 0; i < n && c.ok; i++)
   {
     QString v;
-    read(ba, pos, v);
+    read(c, v);
     str_list.append(v);
   }
 }
@@ -218,7 +291,7 @@ template<class Key, class Value>
 inline void write(QByteArray& ba, const QMap<Key, Value>& map)
 {
   QMapIterator<Key, Value> i(map);
-  write(ba, map.count());
+  write(ba, int(map.count()));
   while (i.hasNext())
   {
     i.next();
@@ -228,18 +301,19 @@ inline void write(QByteArray& ba, const QMap<Key, Value>& map)
 }
 
 template<class Key, class Value>
-inline void read(const QByteArray& ba, int& pos,
-                 QMap<Key, Value>& map)
+inline void read(Cursor& c, QMap<Key, Value>& map)
 {
-  int count;
-  read(ba, pos, count);
+  int count = 0;
+  read(c, count);
   map.clear();
-  for (int i = 0; i < count; i++)
+  if (!c.check(count, 1))
+    return;
+  for (int i = 0; i < count && c.ok; i++)
   {
     Key key;
-    read(ba, pos, key);
+    read(c, key);
     Value value;
-    read(ba, pos, value);
+    read(c, value);
     map.insert(key, value);
   }
 }
@@ -248,7 +322,7 @@ template<class Key, class Value>
 inline void write(QFile* f, const QMap<Key, Value>& map)
 {
   QMapIterator<Key, Value> i(map);
-  write(f, map.count());
+  write(f, int(map.count()));
   while (i.hasNext())
   {
     i.next();
@@ -0,0 +1,213 @@
+#include "flashtagmatcher.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+#include <QVarLengthArray>
+#include <QtConcurrent>
+#include <numeric>
+
+static bool isAnyValue(const QString& v)
+{
+  return v.isEmpty() || v == "*";
+}
+
+static quint64 getPairKey(int key_id, int value_id)
+{
+  return (quint64(key_id) << 32) | quint32(value_id);
+}
+
+FlashTagMatcher::FlashTagMatcher(const QVector<FlashClass>& classes)
+{
+  rules.resize(classes.count());
+  QVector<int> exact_counts(classes.count());
+  for (int class_idx = -1; auto& cl: classes)
+  {
+    class_idx++;
+    for (auto i = cl.detect_tags.begin(); i != cl.detect_tags.end();
+         i++)
+    {
+      auto key    = i.key().toUtf8();
+      int  key_id = key_ids.value(key, -1);
+      if (key_id < 0)
+      {
+        key_id = key_ids.count();
+        key_ids.insert(key, key_id);
+        any_value_candidates.append(QVector<int>());
+      }
+      if (isAnyValue(i.value()))
+        any_value_candidates[key_id].append(class_idx);
+      else
+      {
+        auto value    = i.value().toUtf8();
+        int  value_id = value_ids.value(value, -1);
+        if (value_id < 0)
+        {
+          value_id = value_ids.count();
+          value_ids.insert(value, value_id);
+        }
+        exact_candidates[getPairKey(key_id, value_id)].append(
+            class_idx);
+        exact_counts[class_idx]++;
+      }
+    }
+    rules[class_idx].tag_count = cl.detect_tags.count();
+  }
+
+  QVector<int> order(classes.count());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+                   [&](int a, int b)
+                   {
+                     if (rules.at(a).tag_count !=
+                         rules.at(b).tag_count)
+                       return rules.at(a).tag_count >
+                              rules.at(b).tag_count;
+                     return exact_counts.at(a) > exact_counts.at(b);
+                   });
+  for (int rank = -1; auto class_idx: order)
+    rules[class_idx].rank = ++rank;
+}
+
+int FlashTagMatcher::getKeyId(const QByteArray& key) const
+{
+  return key_ids.value(key, -1);
+}
+
+int FlashTagMatcher::getValueId(const QByteArray& value) const
+{
+  return value_ids.value(value, -1);
+}
+
+int FlashTagMatcher::match(const int* tag_key_ids,
+                           const int* tag_value_ids, int count) const
+{
+  thread_local QVector<uchar> hit_counts;
+  if (hit_counts.count() < rules.count())
+    hit_counts.resize(rules.count());
+  QVarLengthArray<int, 64> touched;
+
+  auto hit = [&](const QVector<int>& candidates)
+  {
+    for (auto class_idx: candidates)
+    {
+      if (hit_counts[class_idx]++ == 0)
+        touched.append(class_idx);
+    }
+  };
+
+  for (int i = 0; i < count; i++)
+  {
+    int key_id = tag_key_ids[i];
+    if (key_id < 0)
+      continue;
+    hit(any_value_candidates.at(key_id));
+    int value_id = tag_value_ids[i];
+    if (value_id < 0)
+      continue;
+    auto it = exact_candidates.constFind(getPairKey(key_id, value_id));
+    if (it != exact_candidates.constEnd())
+      hit(it.value());
+  }
+
+  int best_class_idx = -1;
+  int best_rank      = std::numeric_limits<int>::max();
+  for (auto class_idx: touched)
+  {
+    auto& rule = rules.at(class_idx);
+    if (hit_counts.at(class_idx) == rule.tag_count &&
+        rule.rank < best_rank)
+    {
+      best_rank      = rule.rank;
+      best_class_idx = class_idx;
+    }
+    hit_counts[class_idx] = 0;
+  }
+  return best_class_idx;
+}
+
+int FlashTagMatcher::match(const QVector<Tag>& tags) const
+{
+  QVarLengthArray<int, 32> tag_key_ids(tags.count());
+  QVarLengthArray<int, 32> tag_value_ids(tags.count());
+  for (int i = -1; auto& tag: tags)
+  {
+    i++;
+    tag_key_ids[i]   = getKeyId(tag.key);
+    tag_value_ids[i] = getValueId(tag.value);
+  }
+  return match(tag_key_ids.data(), tag_value_ids.data(), tags.count());
+}
+
+int FlashTagMatcher::match(const QMap<QString, QString>& tags) const
+{
+  QVector<Tag> tag_list;
+  tag_list.reserve(tags.count());
+  for (auto i = tags.begin(); i != tags.end(); i++)
+    tag_list.append({i.key().toUtf8(), i.value().toUtf8()});
+  return match(tag_list);
+}
+
+double FlashTagMatcher::benchmark(int element_count,
+                                  int thread_count) const
+{
+  QRandomGenerator rand(1);
+  QVector<Tag>     known_tags;
+  auto             keys   = key_ids.keys();
+  auto             values = value_ids.keys();
+  std::sort(keys.begin(), keys.end());
+  std::sort(values.begin(), values.end());
+  for (auto& key: keys)
+    for (int i = 0; i < std::min(8, int(values.count())); i++)
+      known_tags.append(
+          {key, values.at(rand.bounded(int(values.count())))});
+  QVector<Tag> noise_tags = {{"name", "Main street"},
+                             {"source", "survey"},
+                             {"note", "fixme"},
+                             {"addr:housenumber", "12"}};
+
+  QVector<QVector<Tag>> elements(element_count);
+  for (auto& element: elements)
+  {
+    int tag_count = rand.bounded(1, 7);
+    for (int i = 0; i < tag_count; i++)
+    {
+      if (!known_tags.isEmpty() && rand.bounded(2) == 0)
+        element.append(
+            known_tags.at(rand.bounded(int(known_tags.count()))));
+      else
+        element.append(
+            noise_tags.at(rand.bounded(int(noise_tags.count()))));
+    }
+  }
+
+  thread_count = std::max(1, thread_count);
+  QVector<QPair<int, int>> slices;
+  int slice_size = std::ceil(1.0 * element_count / thread_count);
+  for (int start = 0; start < element_count; start += slice_size)
+    slices.append(
+        {start, std::min(element_count, start + slice_size)});
+
+  QThreadPool pool;
+  pool.setMaxThreadCount(thread_count);
+  QAtomicInt    matched_count;
+  QElapsedTimer t;
+  t.start();
+  QtConcurrent::blockingMap(&pool, slices,
+                            [&](const QPair<int, int>& slice)
+                            {
+                              int matched = 0;
+                              for (int i = slice.first;
+                                   i < slice.second; i++)
+                                if (match(elements.at(i)) >= 0)
+                                  matched++;
+                              matched_count.fetchAndAddRelaxed(
+                                  matched);
+                            });
+  double secs             = std::max(1ll, t.nsecsElapsed()) * 1E-9;
+  double elements_per_sec = element_count / secs;
+  qDebug() << "tag matcher:" << element_count << "elements,"
+           << thread_count << "threads," << matched_count.loadRelaxed()
+           << "matched," << qint64(elements_per_sec * 60)
+           << "elements/min";
+  return elements_per_sec;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "flashclass.h"
+#include <QHash>
+
+class FlashTagMatcher
+{
+  struct Rule
+  {
+    int tag_count = 0;
+    int rank      = 0;
+  };
+
+  QHash<QByteArray, int>       key_ids;
+  QHash<QByteArray, int>       value_ids;
+  QHash<quint64, QVector<int>> exact_candidates;
+  QVector<QVector<int>>        any_value_candidates;
+  QVector<Rule>                rules;
+
+public:
+  struct Tag
+  {
+    QByteArray key;
+    QByteArray value;
+  };
+
+  FlashTagMatcher() = default;
+  explicit FlashTagMatcher(const QVector<FlashClass>&);
+
+  int getKeyId(const QByteArray&) const;
+  int getValueId(const QByteArray&) const;
+  int match(const int* key_ids, const int* value_ids,
+            int count) const;
+  int match(const QVector<Tag>&) const;
+  int match(const QMap<QString, QString>&) const;
+
+  double benchmark(int element_count, int thread_count) const;
+};
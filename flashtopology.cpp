@@ -0,0 +1,250 @@
+#include "flashtopology.h"
+#include "flashserialize.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QSet>
+#include <cmath>
+
+static quint64 getPointKey(const FlashGeoCoor& p)
+{
+  return (quint64(quint32(p.lat)) << 32) | quint32(p.lon);
+}
+
+QByteArray FlashTopology::getArcKey(const FlashGeoPolygon& arc)
+{
+  return QByteArray((const char*)arc.constData(),
+                    arc.count() * sizeof(FlashGeoCoor));
+}
+
+int FlashTopology::addArc(const FlashGeoPolygon&  arc,
+                          QHash<QByteArray, int>& arc_idxs)
+{
+  auto key = getArcKey(arc);
+  if (auto it = arc_idxs.find(key); it != arc_idxs.end())
+    return it.value();
+  FlashGeoPolygon reversed = arc;
+  std::reverse(reversed.begin(), reversed.end());
+  if (auto it = arc_idxs.find(getArcKey(reversed)); it != arc_idxs.end())
+    return ~it.value();
+  arcs.append(arc);
+  arc_idxs.insert(key, arcs.count() - 1);
+  return arcs.count() - 1;
+}
+
+QVector<FlashTopology::ArcRefs>
+FlashTopology::build(const QVector<FlashGeoPolygon>& _rings,
+                     int                             _coor_precision_coef)
+{
+  arcs.clear();
+  coor_precision_coef = std::max(1, _coor_precision_coef);
+  auto quantize       = [this](int v)
+  {
+    return int(std::llround(double(v) / coor_precision_coef) *
+               coor_precision_coef);
+  };
+
+  QVector<FlashGeoPolygon> rings;
+  for (auto& src_ring: _rings)
+  {
+    FlashGeoPolygon ring;
+    for (auto p: src_ring)
+    {
+      p.lat = quantize(p.lat);
+      p.lon = quantize(p.lon);
+      ring.append(p);
+    }
+    rings.append(ring);
+  }
+
+  QHash<quint64, QSet<quint64>> neighbours;
+  for (auto& ring: rings)
+    for (int i = 0; i < ring.count(); i++)
+    {
+      int   n    = ring.count();
+      auto  key  = getPointKey(ring.at(i));
+      auto& keys = neighbours[key];
+      for (auto& p: {ring.at((i + n - 1) % n), ring.at((i + 1) % n)})
+        if (getPointKey(p) != key)
+          keys.insert(getPointKey(p));
+    }
+  auto isJunction = [&neighbours](const FlashGeoCoor& p)
+  { return neighbours.value(getPointKey(p)).count() > 2; };
+
+  QHash<QByteArray, int> arc_idxs;
+  QVector<ArcRefs>       ret;
+  for (auto& ring: rings)
+  {
+    ArcRefs refs;
+    int     n = ring.count();
+    if (n > 0)
+    {
+      FlashGeoPolygon arc;
+      arc.append(ring.first());
+      for (int i = 1; i <= n; i++)
+      {
+        auto& p = ring.at(i % n);
+        arc.append(p);
+        if (i == n || isJunction(p))
+        {
+          refs.append(addArc(arc, arc_idxs));
+          arc = FlashGeoPolygon();
+          arc.append(p);
+        }
+      }
+    }
+    ret.append(refs);
+  }
+  return ret;
+}
+
+FlashGeoPolygon FlashTopology::getRing(const ArcRefs& refs) const
+{
+  FlashGeoPolygon ring;
+  for (auto ref: refs)
+  {
+    int arc_idx = ref >= 0 ? ref : ~ref;
+    if (arc_idx >= arcs.count())
+      continue;
+    auto& arc = arcs.at(arc_idx);
+    if (ref >= 0)
+      for (int i = 0; i < arc.count() - 1; i++)
+        ring.append(arc.at(i));
+    else
+      for (int i = arc.count() - 1; i > 0; i--)
+        ring.append(arc.at(i));
+  }
+  return ring;
+}
+
+int FlashTopology::getArcCount() const
+{
+  return arcs.count();
+}
+
+bool FlashTopology::isEmpty() const
+{
+  return arcs.isEmpty();
+}
+
+void FlashTopology::save(QByteArray& ba) const
+{
+  using namespace FlashSerialize;
+  write(ba, coor_precision_coef);
+  write(ba, int(arcs.count()));
+  for (auto& arc: arcs)
+    arc.save(ba, coor_precision_coef);
+}
+
+void FlashTopology::load(FlashSerialize::Cursor& c)
+{
+  using namespace FlashSerialize;
+  int arc_count = 0;
+  read(c, coor_precision_coef);
+  read(c, arc_count);
+  arcs.clear();
+  if (!c.check(arc_count, sizeof(int)))
+    return;
+  arcs.resize(arc_count);
+  for (auto& arc: arcs)
+    arc.load(c, coor_precision_coef);
+}
+
+void FlashTopology::benchmark(int side_num, int edge_point_count)
+{
+  constexpr int base      = 500000000;
+  constexpr int step      = 1000000;
+  constexpr int coef      = 100;
+  auto          getJitter = [](int i, int j, int k)
+  {
+    quint32 h = i * 73856093u ^ j * 19349663u ^ k * 83492791u;
+    return int(h % (step / 4 / coef)) * coef;
+  };
+  auto getEdge = [&](int i, int j, bool is_vertical)
+  {
+    FlashGeoPolygon edge;
+    for (int k = 1; k <= edge_point_count; k++)
+    {
+      int along  = k * step / (edge_point_count + 1) / coef * coef;
+      int jitter = getJitter(i, j, k * 2 + is_vertical);
+      if (is_vertical)
+        edge.append(FlashGeoCoor(base + i * step + along,
+                                 base + j * step + jitter));
+      else
+        edge.append(FlashGeoCoor(base + i * step + jitter,
+                                 base + j * step + along));
+    }
+    return edge;
+  };
+  auto getCorner = [](int i, int j)
+  { return FlashGeoCoor(base + i * step, base + j * step); };
+
+  QVector<FlashGeoPolygon> rings;
+  for (int i = 0; i < side_num; i++)
+    for (int j = 0; j < side_num; j++)
+    {
+      FlashGeoPolygon ring;
+      auto            top    = getEdge(i, j, false);
+      auto            right  = getEdge(i, j + 1, true);
+      auto            bottom = getEdge(i + 1, j, false);
+      auto            left   = getEdge(i, j, true);
+      std::reverse(bottom.begin(), bottom.end());
+      std::reverse(left.begin(), left.end());
+      ring.append(getCorner(i, j));
+      ring.append(top);
+      ring.append(getCorner(i, j + 1));
+      ring.append(right);
+      ring.append(getCorner(i + 1, j + 1));
+      ring.append(bottom);
+      ring.append(getCorner(i + 1, j));
+      ring.append(left);
+      rings.append(ring);
+    }
+
+  QByteArray plain_ba;
+  for (auto& ring: rings)
+    ring.save(plain_ba, coef);
+  QElapsedTimer t;
+  t.start();
+  FlashSerialize::Cursor plain_c(plain_ba);
+  for (int i = 0; i < rings.count(); i++)
+  {
+    FlashGeoPolygon ring;
+    ring.load(plain_c, coef);
+  }
+  double plain_ms = t.nsecsElapsed() * 1E-6;
+
+  FlashTopology topology;
+  auto          ring_refs = topology.build(rings, coef);
+  QByteArray    topo_ba;
+  topology.save(topo_ba);
+  for (auto& refs: ring_refs)
+    FlashSerialize::write(topo_ba, refs);
+  t.restart();
+  FlashSerialize::Cursor topo_c(topo_ba);
+  FlashTopology          loaded;
+  loaded.load(topo_c);
+  QVector<FlashGeoPolygon> loaded_rings;
+  for (int i = 0; i < rings.count(); i++)
+  {
+    ArcRefs refs;
+    FlashSerialize::read(topo_c, refs);
+    loaded_rings.append(loaded.getRing(refs));
+  }
+  double topo_ms = t.nsecsElapsed() * 1E-6;
+
+  int mismatch_count = 0;
+  for (int i = 0; i < rings.count(); i++)
+  {
+    auto& a  = rings.at(i);
+    auto& b  = loaded_rings.at(i);
+    bool  ok = a.count() == b.count();
+    for (int k = 0; ok && k < a.count(); k++)
+      ok = getPointKey(a.at(k)) == getPointKey(b.at(k));
+    mismatch_count += !ok;
+  }
+  qDebug() << "topology benchmark:" << rings.count() << "rings,"
+           << topology.getArcCount() << "arcs, plain" << plain_ba.count()
+           << "bytes" << plain_ms << "ms, topology" << topo_ba.count()
+           << "bytes" << topo_ms << "ms," << mismatch_count
+           << "mismatches";
+}
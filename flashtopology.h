@@ -0,0 +1,28 @@
+#pragma once
+
+#include <QHash>
+#include "flashbase.h"
+
+class FlashTopology
+{
+public:
+  typedef QVector<int> ArcRefs;
+
+private:
+  QVector<FlashGeoPolygon> arcs;
+  int                      coor_precision_coef = 1;
+
+  static QByteArray getArcKey(const FlashGeoPolygon&);
+  int addArc(const FlashGeoPolygon&, QHash<QByteArray, int>& arc_idxs);
+
+public:
+  QVector<ArcRefs> build(const QVector<FlashGeoPolygon>& rings,
+                         int coor_precision_coef);
+  FlashGeoPolygon  getRing(const ArcRefs&) const;
+  int              getArcCount() const;
+  bool             isEmpty() const;
+  void             save(QByteArray&) const;
+  void             load(FlashSerialize::Cursor&);
+
+  static void benchmark(int side_num = 64, int edge_point_count = 16);
+};